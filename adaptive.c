@@ -0,0 +1,166 @@
+#include "adaptive.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+tile_stats *create_tile_stats(int x, int y, int N)
+{
+    tile_stats *ts = (tile_stats *)malloc(sizeof(tile_stats));
+    if (!ts)
+    {
+        fprintf(stderr, "Unable to allocate memory\n");
+        exit(1);
+    }
+
+    ts->x = x;
+    ts->y = y;
+    ts->N = N;
+    ts->tiles_x = (x + ADAPT_TILE - 1) / ADAPT_TILE;
+    ts->tiles_y = (y + ADAPT_TILE - 1) / ADAPT_TILE;
+
+    size_t tiles = (size_t)ts->tiles_x * ts->tiles_y;
+    ts->sum = (uint64_t *)calloc(N * tiles, sizeof(uint64_t));
+    ts->sum2 = (uint64_t *)calloc(N * tiles, sizeof(uint64_t));
+    ts->threshold = (float *)malloc(tiles * sizeof(float));
+    if (!ts->sum || !ts->sum2 || !ts->threshold)
+    {
+        fprintf(stderr, "Unable to allocate memory\n");
+        exit(1);
+    }
+
+    return ts;
+}
+
+// Gathers the statistics of an image that was not rescaled, on the rows of this thread.
+void tile_stats_image(tile_stats *ts, ppm_image *image, int thread_id, int N)
+{
+    uint8_t sample[3];
+
+    int start = thread_id * image->x / N;
+    int end = (thread_id + 1) * image->x / N;
+
+    for (int i = start; i < end; i++)
+    {
+        for (int j = 0; j < image->y; j++)
+        {
+            ppm_pixel *pixel = &image->data[(size_t)i * image->y + j];
+            sample[0] = pixel->red;
+            sample[1] = pixel->green;
+            sample[2] = pixel->blue;
+            tile_stats_add(ts, thread_id, i, j, sample);
+        }
+    }
+}
+
+// Merges the partial sums of all threads and computes the threshold of this thread's tiles.
+void tile_thresholds(tile_stats *ts, int thread_id, int N)
+{
+    size_t tiles = (size_t)ts->tiles_x * ts->tiles_y;
+    size_t start = thread_id * tiles / N;
+    size_t end = (thread_id + 1) * tiles / N;
+
+    for (size_t t = start; t < end; t++)
+    {
+        uint64_t sum = 0, sum2 = 0;
+        for (int k = 0; k < ts->N; k++)
+        {
+            sum += ts->sum[k * tiles + t];
+            sum2 += ts->sum2[k * tiles + t];
+        }
+
+        int ti = t / ts->tiles_y;
+        int tj = t % ts->tiles_y;
+        int rows = ts->x - ti * ADAPT_TILE < ADAPT_TILE ? ts->x - ti * ADAPT_TILE : ADAPT_TILE;
+        int cols = ts->y - tj * ADAPT_TILE < ADAPT_TILE ? ts->y - tj * ADAPT_TILE : ADAPT_TILE;
+        double count = (double)rows * cols;
+
+        double mean = sum / count;
+        double variance = sum2 / count - mean * mean;
+        double stddev = variance > 0 ? sqrt(variance) : 0;
+
+        ts->threshold[t] = mean * (1 + ADAPT_K * (stddev / ADAPT_R - 1));
+    }
+}
+
+// Position of pixel coordinate `pos` between the centers of the tiles along one axis.
+static void tile_position(int pos, int tiles, int *t0, int *t1, float *weight)
+{
+    float f = (pos - ADAPT_TILE / 2.0f) / ADAPT_TILE;
+
+    if (f <= 0)
+    {
+        *t0 = *t1 = 0;
+        *weight = 0;
+    }
+    else if (f >= tiles - 1)
+    {
+        *t0 = *t1 = tiles - 1;
+        *weight = 0;
+    }
+    else
+    {
+        *t0 = (int)f;
+        *t1 = *t0 + 1;
+        *weight = f - *t0;
+    }
+}
+
+// Thresholds the pixel at flat position `index` against the local threshold, interpolated
+// bilinearly between the centers of the four closest tiles.
+static unsigned char adaptive_sample(tile_stats *ts, ppm_image *image, size_t index)
+{
+    int r = index / image->y;
+    int c = index % image->y;
+    int r0, r1, c0, c1;
+    float wr, wc;
+
+    tile_position(r, ts->tiles_x, &r0, &r1, &wr);
+    tile_position(c, ts->tiles_y, &c0, &c1, &wc);
+
+    float *t = ts->threshold;
+    float top = t[r0 * ts->tiles_y + c0] * (1 - wc) + t[r0 * ts->tiles_y + c1] * wc;
+    float bottom = t[r1 * ts->tiles_y + c0] * (1 - wc) + t[r1 * ts->tiles_y + c1] * wc;
+    float threshold = top * (1 - wr) + bottom * wr;
+
+    ppm_pixel *pixel = &image->data[index];
+    return luminance(pixel->red, pixel->green, pixel->blue) > threshold ? 0 : 1;
+}
+
+// sample_grid() against the local thresholds instead of SIGMA; same points and same borders.
+unsigned char **sample_grid_adaptive(tile_stats *ts, ppm_image *image, unsigned char **grid, int thread_id, int N)
+{
+    int p = image->x / STEP;
+    int q = image->y / STEP;
+
+    int start = thread_id * p / N;
+    int end = (thread_id + 1) * p / N;
+
+    for (int i = start; i < end; i++)
+    {
+        for (int j = 0; j < q; j++)
+        {
+            grid[i][j] = adaptive_sample(ts, image, (size_t)i * STEP * image->y + j * STEP);
+        }
+
+        grid[i][q] = adaptive_sample(ts, image, (size_t)i * STEP * image->y + image->x - 1);
+    }
+    grid[p][q] = 0;
+
+    int start2 = thread_id * q / N;
+    int end2 = (thread_id + 1) * q / N;
+
+    for (int j = start2; j < end2; j++)
+    {
+        grid[p][j] = adaptive_sample(ts, image, (size_t)(image->x - 1) * image->y + j * STEP);
+    }
+
+    return grid;
+}
+
+void free_tile_stats(tile_stats *ts)
+{
+    free(ts->sum);
+    free(ts->sum2);
+    free(ts->threshold);
+    free(ts);
+}
@@ -0,0 +1,47 @@
+#ifndef ADAPTIVE_H
+#define ADAPTIVE_H
+
+#include "helpers.h"
+
+// Side of the tiles on which the local statistics are gathered, in pixels of the sampled image.
+#define ADAPT_TILE  64
+// Sauvola's parameters: threshold = mean * (1 + k * (stddev / R - 1)).
+#define ADAPT_K     0.2f
+#define ADAPT_R     128.0f
+
+// Luminance statistics on a coarse grid of ADAPT_TILE x ADAPT_TILE tiles. Every thread adds up
+// its own pixels in sum / sum2[thread_id * tiles_x * tiles_y + tile]; the partial sums are
+// merged into one threshold per tile once all threads are done.
+typedef struct tile_stats
+{
+    int x, y;
+    int tiles_x, tiles_y;
+    int N;
+    uint64_t *sum;
+    uint64_t *sum2;
+    float *threshold;
+} tile_stats;
+
+// Luminance of a pixel, computed exactly as in sample_grid().
+static inline unsigned char luminance(unsigned char red, unsigned char green, unsigned char blue)
+{
+    return (red + green + blue) / 3;
+}
+
+// Adds pixel (i, j) of the sampled image to the statistics of this thread.
+static inline void tile_stats_add(tile_stats *ts, int thread_id, int i, int j, uint8_t sample[])
+{
+    size_t tile = (size_t)thread_id * ts->tiles_x * ts->tiles_y + (i / ADAPT_TILE) * ts->tiles_y + j / ADAPT_TILE;
+    unsigned lum = luminance(sample[0], sample[1], sample[2]);
+
+    ts->sum[tile] += lum;
+    ts->sum2[tile] += lum * lum;
+}
+
+tile_stats *create_tile_stats(int x, int y, int N);
+void tile_stats_image(tile_stats *ts, ppm_image *image, int thread_id, int N);
+void tile_thresholds(tile_stats *ts, int thread_id, int N);
+unsigned char **sample_grid_adaptive(tile_stats *ts, ppm_image *image, unsigned char **grid, int thread_id, int N);
+void free_tile_stats(tile_stats *ts);
+
+#endif
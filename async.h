@@ -0,0 +1,65 @@
+#ifndef ASYNC_H
+#define ASYNC_H
+
+#include "helpers.h"
+#include "pool.h"
+#include "vector.h"
+
+// Non-blocking contouring API for event-loop services, built with `make lib` into libtema1.so.
+// Every contour_submit() becomes one job of the engine's worker pool, so any number of images
+// can be in flight without a thread per request. Submitting is safe from several threads.
+
+// Flags of contour_submit(). The contour image is always produced.
+#define CONTOUR_BORROWED    1       // the caller keeps ownership of the input image
+#define CONTOUR_GRID        2       // keep the sample grid, see contour_take_grid()
+#define CONTOUR_VECTOR      4       // extract the contour segments, see contour_take_index()
+
+// march_threads of contour_engine_create(): 0 runs march on all N threads, MARCH_THREADS_CORES on
+// one thread per physical core.
+#define MARCH_THREADS_CORES -1
+
+typedef struct contour_job contour_job;
+typedef void (*contour_callback)(contour_job *job, void *data);
+
+typedef struct contour_engine
+{
+    worker_pool *pool;
+    ppm_image **contour_map;
+    int march_threads;
+} contour_engine;
+
+// One submitted image. It is shared by the caller and the pool and freed once both released it,
+// so contour_job_free() may be called at any time, from the callback too.
+struct contour_job
+{
+    contour_engine *engine;
+    ppm_image *image;
+    int outputs;
+    ppm_image *result;
+    unsigned char **grid;
+    int grid_rows, grid_columns;
+    contour_index *index;
+    struct image *imagine;
+    pthread_barrier_t barrier;
+    contour_callback callback;
+    void *data;
+    pthread_mutex_t lock;
+    pthread_cond_t finished;
+    int done;
+    int event_fd;
+    int refs;
+};
+
+contour_engine *contour_engine_create(int N, int march_threads);
+contour_job *contour_submit(contour_engine *engine, ppm_image *image, int outputs, contour_callback callback,
+                            void *data);
+int contour_job_fd(contour_job *job);
+int contour_job_done(contour_job *job);
+ppm_image *contour_take(contour_job *job);
+unsigned char **contour_take_grid(contour_job *job, int *rows, int *columns);
+contour_index *contour_take_index(contour_job *job);
+ppm_image *contour_wait(contour_job *job);
+void contour_job_free(contour_job *job);
+void contour_engine_destroy(contour_engine *engine);
+
+#endif
@@ -0,0 +1,293 @@
+// Microbenchmarks for the kernels of the contour pipeline, each measured in isolation with a
+// warm cache (after a warm-up run) and a cold cache (after evicting a buffer larger than the
+// last level cache).
+//
+// Usage: ./bench [image size] [repeats] [cost model file]
+//
+// With a third argument, the warm costs are also written as a cost model for --slo.
+
+#include "helpers.h"
+#include "contour.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#define BENCH_SIZE      512
+#define BENCH_REPEATS   5
+#define EVICT_SIZE      (64 << 20)
+#define THREAD_SPAWNS   64
+
+typedef struct bench
+{
+    const char *name;
+    const char *unit;
+    // units processed and bytes of image data touched by one run (0 for pure compute)
+    double units;
+    double bytes;
+    void (*run)(void);
+    // best warm time per unit, filled in by measure()
+    double warm_ns;
+} bench;
+
+static ppm_image *source;
+static ppm_image *target;
+static ppm_image **contour_map;
+static unsigned char **grid;
+static unsigned char *evict;
+static volatile float float_sink;
+static volatile unsigned sink;
+
+static double now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static uint64_t cycles()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+static void evict_caches()
+{
+    for (size_t i = 0; i < EVICT_SIZE; i += 64)
+    {
+        evict[i]++;
+    }
+}
+
+static void run_cubic_hermite()
+{
+    float acc = 0;
+    for (int i = 0; i < source->x * source->y; i++)
+    {
+        acc += cubic_hermite(i & 255, (i >> 1) & 255, (i >> 2) & 255, (i >> 3) & 255, (i & 63) / 64.0f);
+    }
+    float_sink = acc;
+}
+
+static void run_get_pixel_clamped()
+{
+    uint8_t temp[3];
+    unsigned acc = 0;
+    for (int y = 0; y < source->y; y++)
+    {
+        for (int x = 0; x < source->x; x++)
+        {
+            get_pixel_clamped(source, x, y, temp);
+            acc += temp[0];
+        }
+    }
+    sink = acc;
+}
+
+static void run_sample_bicubic()
+{
+    uint8_t sample[3];
+    unsigned acc = 0;
+    for (int i = 0; i < target->x; i++)
+    {
+        for (int j = 0; j < target->y; j++)
+        {
+            sample_bicubic(source, (float)i / (target->x - 1), (float)j / (target->y - 1), sample);
+            acc += sample[0];
+        }
+    }
+    sink = acc;
+}
+
+static void run_sample_bilinear()
+{
+    uint8_t sample[3];
+    unsigned acc = 0;
+    for (int i = 0; i < target->x; i++)
+    {
+        for (int j = 0; j < target->y; j++)
+        {
+            sample_bilinear(source, (float)i / (target->x - 1), (float)j / (target->y - 1), sample);
+            acc += sample[0];
+        }
+    }
+    sink = acc;
+}
+
+static void run_update_image()
+{
+    for (int i = 0; i + STEP <= target->x; i += STEP)
+    {
+        for (int j = 0; j + STEP <= target->y; j += STEP)
+        {
+            update_image(target, contour_map[(i + j) / STEP % CONTOUR_CONFIG_COUNT], i, j);
+        }
+    }
+}
+
+static void run_sample_grid()
+{
+    sample_grid(source, grid, 0, 1);
+}
+
+static void run_cell_config()
+{
+    unsigned acc = 0;
+    for (int i = 0; i < source->x / STEP; i++)
+    {
+        for (int j = 0; j < source->y / STEP; j++)
+        {
+            acc += cell_config(grid, i, j);
+        }
+    }
+    sink = acc;
+}
+
+static void *idle_worker(void *arg)
+{
+    return arg;
+}
+
+// Starting and joining a worker, the fixed cost every extra thread adds to a run.
+static void run_thread_spawn()
+{
+    for (int k = 0; k < THREAD_SPAWNS; k++)
+    {
+        pthread_t thread;
+        pthread_create(&thread, NULL, idle_worker, NULL);
+        pthread_join(thread, NULL);
+    }
+}
+
+static void measure(bench *b, int cold, int repeats)
+{
+    double best_ns = 0;
+    uint64_t best_cycles = 0;
+
+    // warm-up, also faults in every page touched by the kernel
+    b->run();
+
+    for (int r = 0; r < repeats; r++)
+    {
+        if (cold)
+        {
+            evict_caches();
+        }
+
+        uint64_t c0 = cycles();
+        double t0 = now_ns();
+        b->run();
+        double t1 = now_ns();
+        uint64_t c1 = cycles();
+
+        if (r == 0 || t1 - t0 < best_ns)
+        {
+            best_ns = t1 - t0;
+            best_cycles = c1 - c0;
+        }
+    }
+
+    if (!cold)
+    {
+        b->warm_ns = best_ns / b->units;
+    }
+
+    printf("%-20s %-5s %10.2f ns/%-6s", b->name, cold ? "cold" : "warm", best_ns / b->units, b->unit);
+    if (best_cycles && b->bytes > 0)
+    {
+        printf(" %8.3f bytes/cycle\n", b->bytes / best_cycles);
+    }
+    else
+    {
+        printf("        - bytes/cycle\n");
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    int size = argc > 1 ? atoi(argv[1]) : BENCH_SIZE;
+    int repeats = argc > 2 ? atoi(argv[2]) : BENCH_REPEATS;
+
+    if (size < 2 * STEP || repeats < 1)
+    {
+        fprintf(stderr, "Usage: ./bench [image size] [repeats] [cost model file]\n");
+        return 1;
+    }
+
+    srand(42);
+
+    source = allocate_image(size, size);
+    target = allocate_image(size, size);
+    for (int i = 0; i < size * size; i++)
+    {
+        source->data[i].red = rand() & 255;
+        source->data[i].green = rand() & 255;
+        source->data[i].blue = rand() & 255;
+    }
+
+    // synthetic contour tiles, so the benchmark does not depend on ./contours
+    contour_map = (ppm_image **)malloc(CONTOUR_CONFIG_COUNT * sizeof(ppm_image *));
+    for (int k = 0; k < CONTOUR_CONFIG_COUNT; k++)
+    {
+        contour_map[k] = allocate_image(STEP, STEP);
+        memset(contour_map[k]->data, k * 16, STEP * STEP * sizeof(ppm_pixel));
+    }
+
+    grid = allocate_grid(source);
+    sample_grid(source, grid, 0, 1);
+
+    evict = (unsigned char *)calloc(EVICT_SIZE, 1);
+    if (!evict)
+    {
+        fprintf(stderr, "Unable to allocate memory\n");
+        return 1;
+    }
+
+    double pixels = (double)size * size;
+    double cells = (double)(size / STEP) * (size / STEP);
+
+    bench benches[] = {
+        {"cubic_hermite", "call", pixels, 0, run_cubic_hermite, 0},
+        {"get_pixel_clamped", "pixel", pixels, pixels * 3, run_get_pixel_clamped, 0},
+        {"sample_bicubic", "pixel", pixels, pixels * 16 * 3, run_sample_bicubic, 0},
+        {"sample_bilinear", "pixel", pixels, pixels * 4 * 3, run_sample_bilinear, 0},
+        {"update_image", "tile", cells, cells * STEP * STEP * 3 * 2, run_update_image, 0},
+        {"sample_grid", "cell", cells, cells * (3 + 1), run_sample_grid, 0},
+        {"cell_config", "cell", cells, cells * 4, run_cell_config, 0},
+        {"thread_spawn", "thread", THREAD_SPAWNS, 0, run_thread_spawn, 0},
+    };
+    int count = sizeof(benches) / sizeof(benches[0]);
+
+    printf("image %dx%d, step %d, best of %d runs\n", size, size, STEP, repeats);
+    for (int b = 0; b < count; b++)
+    {
+        measure(&benches[b], 0, repeats);
+        measure(&benches[b], 1, repeats);
+    }
+
+    // same "<kernel> <ns per unit>" lines that load_cost_model() reads
+    if (argc > 3)
+    {
+        FILE *fp = fopen(argv[3], "w");
+        if (!fp)
+        {
+            fprintf(stderr, "Unable to open file '%s'\n", argv[3]);
+            return 1;
+        }
+        for (int b = 0; b < count; b++)
+        {
+            fprintf(fp, "%s %.3f\n", benches[b].name, benches[b].warm_ns);
+        }
+        fclose(fp);
+    }
+
+    free(evict);
+    return 0;
+}
@@ -0,0 +1,257 @@
+#include "change.h"
+#include "contour.h"
+#include <string.h>
+
+static void *change_alloc(size_t size)
+{
+    void *ptr = calloc(1, size ? size : 1);
+    if (!ptr)
+    {
+        fprintf(stderr, "Unable to allocate memory\n");
+        exit(1);
+    }
+    return ptr;
+}
+
+// `x` and `y` are the size of the rescaled input, which the earlier image is sampled at.
+change_set *create_change_set(row_source *before_source, int x, int y, int N)
+{
+    change_set *cs = (change_set *)change_alloc(sizeof(change_set));
+
+    cs->before = before_source->image;
+    cs->before_source = before_source;
+    cs->x = x;
+    cs->y = y;
+    cs->p = x / STEP;
+    cs->q = y / STEP;
+    cs->before_grid = (unsigned char **)change_alloc((cs->p + 1) * sizeof(unsigned char *));
+    for (int i = 0; i <= cs->p; i++)
+    {
+        cs->before_grid[i] = (unsigned char *)change_alloc(cs->q + 1);
+    }
+    cs->row_bytes = (cs->q + 7) / 8;
+    cs->bits = (unsigned char *)change_alloc((size_t)cs->p * cs->row_bytes);
+    cs->N = N;
+    cs->changed = (uint64_t *)change_alloc(N * sizeof(uint64_t));
+    cs->appeared = (uint64_t *)change_alloc(N * sizeof(uint64_t));
+    cs->vanished = (uint64_t *)change_alloc(N * sizeof(uint64_t));
+    cs->bounds = (int (*)[4])change_alloc(N * sizeof(*cs->bounds));
+
+    // threads past the march threads find no changes
+    for (int t = 0; t < N; t++)
+    {
+        cs->bounds[t][0] = cs->p;
+        cs->bounds[t][1] = -1;
+        cs->bounds[t][2] = cs->q;
+        cs->bounds[t][3] = -1;
+    }
+
+    return cs;
+}
+
+// Sample point of the earlier image at pixel `index` of the rescaled image, with the bicubic
+// interpolation rescale_image() would have used for that pixel.
+static unsigned char before_point(change_set *cs, int index)
+{
+    ppm_image *image = cs->before;
+    ppm_pixel pixel;
+
+    if (image->x == cs->x && image->y == cs->y)
+    {
+        if (cs->before_source)
+        {
+            wait_rows(cs->before_source, index / image->x + 1);
+        }
+        pixel = image->data[index];
+    }
+    else
+    {
+        uint8_t sample[3];
+        float u = (float)(index / cs->y) / (float)(cs->x - 1);
+        float v = (float)(index % cs->y) / (float)(cs->y - 1);
+
+        if (cs->before_source)
+        {
+            // same source row computation as in rescale_progressive()
+            wait_rows(cs->before_source, (int)(v * image->y - 0.5) + 3);
+        }
+        sample_bicubic(image, u, v, sample);
+        pixel.red = sample[0];
+        pixel.green = sample[1];
+        pixel.blue = sample[2];
+    }
+
+    return (pixel.red + pixel.green + pixel.blue) / 3 > SIGMA ? 0 : 1;
+}
+
+// sample_grid() of the rescaled earlier image, without rescaling it: only the pixels that
+// sample_grid() reads are interpolated, which is 1 / (STEP * STEP) of the rescaling work.
+void sample_before(change_set *cs, int thread_id, int N)
+{
+    int p = cs->p;
+    int q = cs->q;
+    unsigned char **grid = cs->before_grid;
+
+    for (int i = thread_id * p / N; i < (thread_id + 1) * p / N; i++)
+    {
+        for (int j = 0; j < q; j++)
+        {
+            grid[i][j] = before_point(cs, i * STEP * cs->y + j * STEP);
+        }
+        grid[i][q] = before_point(cs, i * STEP * cs->y + cs->x - 1);
+    }
+    for (int j = thread_id * q / N; j < (thread_id + 1) * q / N; j++)
+    {
+        grid[p][j] = before_point(cs, (cs->x - 1) * cs->y + j * STEP);
+    }
+    grid[p][q] = 0;
+}
+
+// XOR of two rows of sample points, 8 points at a time.
+static void xor_row(const unsigned char *a, const unsigned char *b, unsigned char *out, int n)
+{
+    int j = 0;
+
+    for (; j + 8 <= n; j += 8)
+    {
+        uint64_t wa, wb;
+        memcpy(&wa, a + j, 8);
+        memcpy(&wb, b + j, 8);
+        wa ^= wb;
+        memcpy(out + j, &wa, 8);
+    }
+    for (; j < n; j++)
+    {
+        out[j] = a[j] ^ b[j];
+    }
+}
+
+// Marches, on the cell rows of this thread, only the cells that changed: a cell changed if any
+// of its four sample points differs between the grids. Cells that did not change keep the pixels
+// of the rescaled image.
+void march_changes(change_set *cs, ppm_image *image, unsigned char **grid, ppm_image **contour_map,
+                   int thread_id, int N)
+{
+    int p = cs->p;
+    int q = cs->q;
+    int start = thread_id * p / N;
+    int end = (thread_id + 1) * p / N;
+    unsigned char *upper = (unsigned char *)change_alloc(q + 1);
+    unsigned char *lower = (unsigned char *)change_alloc(q + 1);
+    uint64_t changed = 0, appeared = 0, vanished = 0;
+    int *bounds = cs->bounds[thread_id];
+
+    if (start < end)
+    {
+        xor_row(grid[start], cs->before_grid[start], lower, q + 1);
+    }
+
+    for (int i = start; i < end; i++)
+    {
+        unsigned char *swap = upper;
+        upper = lower;
+        lower = swap;
+        xor_row(grid[i + 1], cs->before_grid[i + 1], lower, q + 1);
+
+        unsigned char *bits = cs->bits + (size_t)i * cs->row_bytes;
+        for (int j = 0; j < q; j++)
+        {
+            if (!(upper[j] | upper[j + 1] | lower[j] | lower[j + 1]))
+            {
+                continue;
+            }
+
+            unsigned char now = cell_config(grid, i, j);
+            unsigned char then = cell_config(cs->before_grid, i, j);
+            update_image(image, contour_map[now], i * STEP, j * STEP);
+
+            bits[j >> 3] |= 0x80 >> (j & 7);
+            changed++;
+            appeared += (then == 0 || then == 15);
+            vanished += (now == 0 || now == 15);
+            if (i < bounds[0])
+            {
+                bounds[0] = i;
+            }
+            bounds[1] = i;
+            if (j < bounds[2])
+            {
+                bounds[2] = j;
+            }
+            if (j > bounds[3])
+            {
+                bounds[3] = j;
+            }
+        }
+    }
+
+    cs->changed[thread_id] = changed;
+    cs->appeared[thread_id] = appeared;
+    cs->vanished[thread_id] = vanished;
+    free(upper);
+    free(lower);
+}
+
+// One line of statistics; the bounding box of the changes is in pixels of the contour image.
+void report_changes(FILE *fp, change_set *cs)
+{
+    uint64_t changed = 0, appeared = 0, vanished = 0;
+    int bounds[4] = {cs->p, -1, cs->q, -1};
+
+    for (int t = 0; t < cs->N; t++)
+    {
+        changed += cs->changed[t];
+        appeared += cs->appeared[t];
+        vanished += cs->vanished[t];
+        if (cs->bounds[t][1] >= 0)
+        {
+            bounds[0] = cs->bounds[t][0] < bounds[0] ? cs->bounds[t][0] : bounds[0];
+            bounds[1] = cs->bounds[t][1] > bounds[1] ? cs->bounds[t][1] : bounds[1];
+            bounds[2] = cs->bounds[t][2] < bounds[2] ? cs->bounds[t][2] : bounds[2];
+            bounds[3] = cs->bounds[t][3] > bounds[3] ? cs->bounds[t][3] : bounds[3];
+        }
+    }
+
+    uint64_t cells = (uint64_t)cs->p * cs->q;
+    fprintf(fp, "changed %llu of %llu cells (%.3f%%), %llu appeared, %llu vanished",
+            (unsigned long long)changed, (unsigned long long)cells, cells ? 100.0 * changed / cells : 0.0,
+            (unsigned long long)appeared, (unsigned long long)vanished);
+    if (changed)
+    {
+        fprintf(fp, ", rows %d-%d, columns %d-%d", bounds[0] * STEP, (bounds[1] + 1) * STEP - 1,
+                bounds[2] * STEP, (bounds[3] + 1) * STEP - 1);
+    }
+    fprintf(fp, "\n");
+}
+
+// The mask is a raw PBM with one pixel per cell, black for the cells that changed.
+void write_change_mask(change_set *cs, const char *filename)
+{
+    FILE *fp = fopen(filename, "wb");
+    if (!fp)
+    {
+        fprintf(stderr, "Unable to open file '%s'\n", filename);
+        exit(1);
+    }
+
+    fprintf(fp, "P4\n%d %d\n", cs->q, cs->p);
+    if (fwrite(cs->bits, cs->row_bytes, cs->p, fp) != (size_t)cs->p)
+    {
+        fprintf(stderr, "Unable to write file '%s'\n", filename);
+        exit(1);
+    }
+    fclose(fp);
+}
+
+void free_change_set(change_set *cs)
+{
+    free_grid(cs->before_grid, cs->p);
+    free(cs->before->data);
+    free(cs->before);
+    free(cs->bits);
+    free(cs->changed);
+    free(cs->appeared);
+    free(cs->vanished);
+    free(cs->bounds);
+    free(cs);
+}
@@ -0,0 +1,34 @@
+#ifndef CHANGE_H
+#define CHANGE_H
+
+#include "helpers.h"
+#include "ingest.h"
+
+// Change detection between the input image and an earlier image of the same scene. The earlier
+// image is sampled next to the input, then the two sample grids are XORed and only the cells
+// whose configuration differs are marched.
+typedef struct change_set
+{
+    ppm_image *before;
+    row_source *before_source;
+    int x, y;                   // size of the rescaled image
+    unsigned char **before_grid;
+    int p, q;
+    int row_bytes;
+    unsigned char *bits;        // p x q cells, 1 if changed, rows padded to whole bytes like PBM
+    int N;
+    uint64_t *changed;          // per thread
+    uint64_t *appeared;         // cells that had no contour before
+    uint64_t *vanished;         // cells that have no contour any more
+    int (*bounds)[4];           // per thread: first row, last row, first column, last column
+} change_set;
+
+change_set *create_change_set(row_source *before_source, int x, int y, int N);
+void sample_before(change_set *cs, int thread_id, int N);
+void march_changes(change_set *cs, ppm_image *image, unsigned char **grid, ppm_image **contour_map,
+                   int thread_id, int N);
+void report_changes(FILE *fp, change_set *cs);
+void write_change_mask(change_set *cs, const char *filename);
+void free_change_set(change_set *cs);
+
+#endif
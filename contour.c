@@ -0,0 +1,504 @@
+// Author: APD team, except where source was noted
+
+#include "contour.h"
+#include "digest.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Creates a map between the binary configuration (e.g. 0110_2) and the corresponding pixels
+// that need to be set on the output image. An array is used for this map since the keys are
+// binary numbers in 0-15. Contour images are located in the './contours' directory.
+ppm_image **init_contour_map()
+{
+    ppm_image **map = (ppm_image **)malloc(CONTOUR_CONFIG_COUNT * sizeof(ppm_image *));
+    if (!map)
+    {
+        fprintf(stderr, "Unable to allocate memory\n");
+        exit(1);
+    }
+
+    for (int i = 0; i < CONTOUR_CONFIG_COUNT; i++)
+    {
+        char filename[FILENAME_MAX_SIZE];
+        sprintf(filename, "./contours/%d.ppm", i);
+        map[i] = read_ppm(filename);
+    }
+
+    return map;
+}
+
+// Updates a particular section of an image with the corresponding contour pixels.
+// Used to create the complete contour image.
+void update_image(ppm_image *image, ppm_image *contour, int x, int y)
+{
+    for (int i = 0; i < contour->x; i++)
+    {
+        for (int j = 0; j < contour->y; j++)
+        {
+            int contour_pixel_index = contour->x * i + j;
+            int image_pixel_index = (x + i) * image->y + y + j;
+
+            image->data[image_pixel_index].red = contour->data[contour_pixel_index].red;
+            image->data[image_pixel_index].green = contour->data[contour_pixel_index].green;
+            image->data[image_pixel_index].blue = contour->data[contour_pixel_index].blue;
+        }
+    }
+}
+
+// Splits every contour tile into the bytes of its line pixels and a mask that selects them, so
+// that the tiles can be drawn over the image instead of replacing it.
+overlay_tile *init_overlay_map(ppm_image **contour_map)
+{
+    overlay_tile *overlay = (overlay_tile *)calloc(CONTOUR_CONFIG_COUNT, sizeof(overlay_tile));
+    if (!overlay)
+    {
+        fprintf(stderr, "Unable to allocate memory\n");
+        exit(1);
+    }
+
+    for (int k = 0; k < CONTOUR_CONFIG_COUNT; k++)
+    {
+        ppm_image *contour = contour_map[k];
+
+        if (contour->x != STEP || contour->y != STEP)
+        {
+            fprintf(stderr, "Contour tile %d is not %dx%d\n", k, STEP, STEP);
+            exit(1);
+        }
+
+        for (int i = 0; i < STEP; i++)
+        {
+            unsigned char mask[STEP * 3];
+            ppm_pixel *row = &contour->data[i * STEP];
+
+            for (int j = 0; j < STEP; j++)
+            {
+                int line = row[j].red != RGB_COMPONENT_COLOR || row[j].green != RGB_COMPONENT_COLOR ||
+                           row[j].blue != RGB_COMPONENT_COLOR;
+                memset(&mask[j * 3], line ? 0xff : 0, 3);
+                if (line)
+                {
+                    overlay[k].rows |= 1u << i;
+                }
+            }
+
+            memcpy(overlay[k].pixels[i], row, STEP * 3);
+            memcpy(overlay[k].mask[i], mask, STEP * 3);
+        }
+    }
+
+    return overlay;
+}
+
+// Same as update_image, but only the line pixels of the tile are written; the rest of the image
+// shows through. Rows of the tile without line pixels are skipped and the others are merged a
+// word (8 bytes) at a time.
+static void overlay_image(ppm_image *image, overlay_tile *tile, int x, int y)
+{
+    for (int i = 0; i < STEP; i++)
+    {
+        if (!(tile->rows >> i & 1))
+        {
+            continue;
+        }
+
+        uint64_t words[OVERLAY_WORDS];
+        unsigned char *dst = (unsigned char *)&image->data[(size_t)(x + i) * image->y + y];
+
+        memcpy(words, dst, sizeof(words));
+        for (int w = 0; w < OVERLAY_WORDS; w++)
+        {
+            words[w] = (words[w] & ~tile->mask[i][w]) | (tile->pixels[i][w] & tile->mask[i][w]);
+        }
+        memcpy(dst, words, sizeof(words));
+    }
+}
+
+// Corresponds to step 1 of the marching squares algorithm, which focuses on sampling the image.
+// Builds a p x q grid of points with values which can be either 0 or 1, depending on how the
+// pixel values compare to the `sigma` reference value. The points are taken at equal distances
+// in the original image, based on the `step_x` and `step_y` arguments.
+unsigned char **sample_grid(ppm_image *image, unsigned char **grid, int thread_id, int N)
+{
+    int p = image->x / STEP;
+    int q = image->y / STEP;
+
+    int start = thread_id * p / N;
+    int end = (thread_id + 1) * p / N;
+
+    for (int i = start; i < end; i++)
+    {
+        for (int j = 0; j < q; j++)
+        {
+            ppm_pixel curr_pixel = image->data[i * STEP * image->y + j * STEP];
+
+            unsigned char curr_color = (curr_pixel.red + curr_pixel.green + curr_pixel.blue) / 3;
+
+            if (curr_color > SIGMA)
+            {
+                grid[i][j] = 0;
+            }
+            else
+            {
+                grid[i][j] = 1;
+            }
+        }
+    }
+    grid[p][q] = 0;
+
+    // last sample points have no neighbors below / to the right, so we use pixels on the
+    // last row / column of the input image for them
+
+    int start1 = thread_id * p / N;
+    int end1 = (thread_id + 1) * p / N;
+
+    for (int i = start1; i < end1; i++)
+    {
+        ppm_pixel curr_pixel = image->data[i * STEP * image->y + image->x - 1];
+
+        unsigned char curr_color = (curr_pixel.red + curr_pixel.green + curr_pixel.blue) / 3;
+
+        if (curr_color > SIGMA)
+        {
+            grid[i][q] = 0;
+        }
+        else
+        {
+            grid[i][q] = 1;
+        }
+    }
+
+    int start2 = thread_id * q / N;
+    int end2 = (thread_id + 1) * q / N;
+
+    for (int j = start2; j < end2; j++)
+    {
+        ppm_pixel curr_pixel = image->data[(image->x - 1) * image->y + j * STEP];
+
+        unsigned char curr_color = (curr_pixel.red + curr_pixel.green + curr_pixel.blue) / 3;
+
+        if (curr_color > SIGMA)
+        {
+            grid[p][j] = 0;
+        }
+        else
+        {
+            grid[p][j] = 1;
+        }
+    }
+
+    return grid;
+}
+
+// Bit of the mask at the position that holds pixel `index` of an x * y image, so that a mask
+// is sampled at the same places sample_grid() samples an image of the same size.
+static inline unsigned char mask_sample(pbm_mask *mask, size_t index)
+{
+    return pbm_bit(mask, index / mask->x, index % mask->x);
+}
+
+// sample_grid() for PBM masks. Black pixels are already the points below the threshold, so the
+// STEP-strided bits are gathered straight into the grid, without any rescaling or averaging.
+unsigned char **sample_mask_grid(pbm_mask *mask, unsigned char **grid, int thread_id, int N)
+{
+    int p = mask->x / STEP;
+    int q = mask->y / STEP;
+
+    int start = thread_id * p / N;
+    int end = (thread_id + 1) * p / N;
+
+    for (int i = start; i < end; i++)
+    {
+        // walk the samples of the row without dividing for each of them
+        size_t index = (size_t)i * STEP * mask->y;
+        int r = index / mask->x;
+        int c = index % mask->x;
+
+        for (int j = 0; j < q; j++)
+        {
+            grid[i][j] = pbm_bit(mask, r, c);
+
+            c += STEP;
+            while (c >= mask->x)
+            {
+                c -= mask->x;
+                r++;
+            }
+        }
+
+        grid[i][q] = mask_sample(mask, (size_t)i * STEP * mask->y + mask->x - 1);
+    }
+    grid[p][q] = 0;
+
+    int start2 = thread_id * q / N;
+    int end2 = (thread_id + 1) * q / N;
+
+    for (int j = start2; j < end2; j++)
+    {
+        grid[p][j] = mask_sample(mask, (size_t)(mask->x - 1) * mask->y + j * STEP);
+    }
+
+    return grid;
+}
+
+// Corresponds to step 2 of the marching squares algorithm, which focuses on identifying the
+// type of contour which corresponds to each subgrid. It determines the binary value of each
+// sample fragment of the original image and replaces the pixels in the original image with
+// the pixels of the corresponding contour image accordingly.
+void march_row(ppm_image *image, unsigned char **grid, ppm_image **contour_map, int i)
+{
+    int q = image->y / STEP;
+
+    for (int j = 0; j < q; j++)
+    {
+        update_image(image, contour_map[cell_config(grid, i, j)], i * STEP, j * STEP);
+    }
+}
+
+void march(ppm_image *image, unsigned char **grid, ppm_image **contour_map, int thread_id, int N)
+{
+    int p = image->x / STEP;
+
+    int start = thread_id * p / N;
+    int end = (thread_id + 1) * p / N;
+
+    for (int i = start; i < end; i++)
+    {
+        march_row(image, grid, contour_map, i);
+    }
+}
+
+// Same as march(), but the contour is drawn over the image it was sampled from.
+void march_overlay(ppm_image *image, unsigned char **grid, overlay_tile *overlay, int thread_id, int N)
+{
+    int p = image->x / STEP;
+    int q = image->y / STEP;
+
+    int start = thread_id * p / N;
+    int end = (thread_id + 1) * p / N;
+
+    for (int i = start; i < end; i++)
+    {
+        for (int j = 0; j < q; j++)
+        {
+            overlay_image(image, &overlay[cell_config(grid, i, j)], i * STEP, j * STEP);
+        }
+    }
+}
+
+// Columns j > 0 of a grid row where the value differs from column j - 1, followed by `len`.
+// Uniform stretches are skipped a word at a time, so sparse rows cost little more than their
+// number of transitions.
+static int row_transitions(const unsigned char *row, int len, int *out)
+{
+    int n = 0;
+    int j = 1;
+
+    while (j < len)
+    {
+        unsigned char v = row[j - 1];
+        uint64_t pattern = 0x0101010101010101ULL * v;
+        uint64_t word;
+
+        while (j + 8 <= len)
+        {
+            memcpy(&word, row + j, sizeof(word));
+            if (word != pattern)
+            {
+                break;
+            }
+            j += 8;
+        }
+        while (j < len && row[j] == v)
+        {
+            j++;
+        }
+
+        if (j < len)
+        {
+            out[n++] = j;
+            j++;
+        }
+    }
+
+    out[n++] = len;
+    return n;
+}
+
+// Writes the contour tile on the cells [j0, j1) of grid row i with one copy per tile row: the
+// first cell is copied from the tile and the rest by doubling what was already written.
+static void fill_cells(ppm_image *image, ppm_image *contour, int i, int j0, int j1)
+{
+    int width = (j1 - j0) * STEP;
+
+    for (int r = 0; r < contour->x; r++)
+    {
+        ppm_pixel *dst = &image->data[(size_t)(i * STEP + r) * image->y + j0 * STEP];
+        int done = contour->y;
+
+        memcpy(dst, &contour->data[contour->x * r], contour->y * sizeof(ppm_pixel));
+        while (done < width)
+        {
+            int len = done < width - done ? done : width - done;
+            memcpy(dst + done, dst, len * sizeof(ppm_pixel));
+            done += len;
+        }
+    }
+}
+
+// march() in the run-length domain. The rows i and i + 1 of the grid are turned into their
+// transitions; between two consecutive transitions of either row both rows are constant, so
+// every cell there has the same configuration and the whole stretch is written as one fill.
+// Only the cells that straddle a transition get their configuration looked up.
+void march_runs(ppm_image *image, unsigned char **grid, ppm_image **contour_map, int thread_id, int N)
+{
+    int p = image->x / STEP;
+    int q = image->y / STEP;
+
+    int start = thread_id * p / N;
+    int end = (thread_id + 1) * p / N;
+
+    int *top = (int *)malloc(3 * (q + 2) * sizeof(int));
+    if (!top)
+    {
+        fprintf(stderr, "Unable to allocate memory\n");
+        exit(1);
+    }
+    int *bottom = top + q + 2;
+    int *bounds = bottom + q + 2;
+
+    for (int i = start; i < end; i++)
+    {
+        int nt = row_transitions(grid[i], q + 1, top);
+        int nb = row_transitions(grid[i + 1], q + 1, bottom);
+
+        // union of both lists, each ends with q + 1
+        int n = 0;
+        for (int a = 0, b = 0; a < nt || b < nb;)
+        {
+            int next = b == nb || (a < nt && top[a] <= bottom[b]) ? top[a] : bottom[b];
+            bounds[n++] = next;
+            while (a < nt && top[a] == next)
+            {
+                a++;
+            }
+            while (b < nb && bottom[b] == next)
+            {
+                b++;
+            }
+        }
+
+        int from = 0;
+        for (int k = 0; k < n; k++)
+        {
+            // columns [from, to) are constant on both rows: cells [from, to - 1) are uniform
+            int to = bounds[k];
+            int last = to - 1 < q ? to - 1 : q;
+
+            if (from < last)
+            {
+                fill_cells(image, contour_map[cell_config(grid, i, from)], i, from, last);
+            }
+            if (to - 1 < q)
+            {
+                update_image(image, contour_map[cell_config(grid, i, to - 1)], i * STEP, (to - 1) * STEP);
+            }
+            from = to;
+        }
+    }
+
+    free(top);
+}
+
+// Same as march(), but hashes each band of STEP image rows right after it is marched, while it
+// is still in cache. The bands follow the grid rows and not the threads, so the combined digest
+// does not depend on N. Band p holds the rows below the last grid row.
+void march_digest(ppm_image *image, unsigned char **grid, ppm_image **contour_map, uint64_t *band_hashes,
+                  int thread_id, int N)
+{
+    int p = image->x / STEP;
+
+    int start = thread_id * p / N;
+    int end = (thread_id + 1) * p / N;
+
+    for (int i = start; i < end; i++)
+    {
+        march_row(image, grid, contour_map, i);
+        band_hashes[i] = digest_rows(image, i * STEP, (i + 1) * STEP);
+    }
+
+    if (thread_id == N - 1)
+    {
+        band_hashes[p] = digest_rows(image, p * STEP, image->x);
+    }
+}
+
+// Calls `free` method on the utilized resources.
+void free_resources(ppm_image *image, ppm_image **contour_map, unsigned char **grid, int step_x)
+{
+    for (int i = 0; i < CONTOUR_CONFIG_COUNT; i++)
+    {
+        free(contour_map[i]->data);
+        free(contour_map[i]);
+    }
+    free(contour_map);
+
+    for (int i = 0; i <= image->x / step_x; i++)
+    {
+        free(grid[i]);
+    }
+    free(grid);
+
+    free(image->data);
+    free(image);
+}
+
+unsigned char **allocate_grid(ppm_image *image)
+{
+
+    int p = image->x / STEP;
+    int q = image->y / STEP;
+    unsigned char **grid = (unsigned char **)malloc((p + 1) * sizeof(unsigned char *));
+    if (!grid)
+    {
+        fprintf(stderr, "Unable to allocate memory\n");
+        exit(1);
+    }
+
+    for (int i = 0; i <= p; i++)
+    {
+        grid[i] = (unsigned char *)malloc((q + 1) * sizeof(unsigned char));
+        if (!grid[i])
+        {
+            fprintf(stderr, "Unable to allocate memory\n");
+            exit(1);
+        }
+    }
+    return grid;
+}
+
+void free_grid(unsigned char **grid, int p)
+{
+    for (int i = 0; i <= p; i++)
+    {
+        free(grid[i]);
+    }
+    free(grid);
+}
+
+// Paints white the pixels march() never writes: the rows below the last full cell and the
+// columns to the right of it. Needed when the image does not start as a copy of the input.
+void fill_margins(ppm_image *image)
+{
+    int rows = image->x / STEP * STEP;
+    int cols = image->y / STEP * STEP;
+
+    for (int i = 0; i < rows; i++)
+    {
+        memset(&image->data[(size_t)i * image->y + cols], RGB_COMPONENT_COLOR,
+               (image->y - cols) * sizeof(ppm_pixel));
+    }
+    memset(&image->data[(size_t)rows * image->y], RGB_COMPONENT_COLOR,
+           (size_t)(image->x - rows) * image->y * sizeof(ppm_pixel));
+}
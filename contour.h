@@ -0,0 +1,45 @@
+#ifndef CONTOUR_H
+#define CONTOUR_H
+
+#include "helpers.h"
+
+// Binary configuration of the cell whose top left sample point is grid[i][j], used as the key
+// of the contour map.
+static inline unsigned char cell_config(unsigned char **grid, int i, int j)
+{
+    return 8 * grid[i][j] + 4 * grid[i][j + 1] + 2 * grid[i + 1][j + 1] + 1 * grid[i + 1][j];
+}
+
+// Bytes in one row of a contour tile, handled as whole 64-bit words by the overlay.
+#define OVERLAY_WORDS (STEP * 3 / 8)
+
+#if (STEP * 3) % 8
+#error "the overlay needs STEP * 3 to be a multiple of 8"
+#endif
+
+// A contour tile prepared for compositing: `mask` has 0xff on the bytes of line (non white)
+// pixels, `rows` has bit i set if row i has any of them.
+typedef struct overlay_tile
+{
+    uint64_t pixels[STEP][OVERLAY_WORDS];
+    uint64_t mask[STEP][OVERLAY_WORDS];
+    uint32_t rows;
+} overlay_tile;
+
+ppm_image **init_contour_map();
+overlay_tile *init_overlay_map(ppm_image **contour_map);
+void update_image(ppm_image *image, ppm_image *contour, int x, int y);
+unsigned char **sample_grid(ppm_image *image, unsigned char **grid, int thread_id, int N);
+unsigned char **sample_mask_grid(pbm_mask *mask, unsigned char **grid, int thread_id, int N);
+void march_row(ppm_image *image, unsigned char **grid, ppm_image **contour_map, int i);
+void march(ppm_image *image, unsigned char **grid, ppm_image **contour_map, int thread_id, int N);
+void march_overlay(ppm_image *image, unsigned char **grid, overlay_tile *overlay, int thread_id, int N);
+void march_runs(ppm_image *image, unsigned char **grid, ppm_image **contour_map, int thread_id, int N);
+void march_digest(ppm_image *image, unsigned char **grid, ppm_image **contour_map, uint64_t *band_hashes,
+                  int thread_id, int N);
+void free_resources(ppm_image *image, ppm_image **contour_map, unsigned char **grid, int step_x);
+unsigned char **allocate_grid(ppm_image *image);
+void free_grid(unsigned char **grid, int p);
+void fill_margins(ppm_image *image);
+
+#endif
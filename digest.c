@@ -0,0 +1,126 @@
+#include "digest.h"
+#include <string.h>
+
+// XXH64, as specified in https://github.com/Cyan4973/xxHash/blob/dev/doc/xxhash_spec.md
+
+#define PRIME64_1 0x9E3779B185EBCA87ULL
+#define PRIME64_2 0xC2B2AE3D27D4EB4FULL
+#define PRIME64_3 0x165667B19E3779F9ULL
+#define PRIME64_4 0x85EBCA77C2B2AE63ULL
+#define PRIME64_5 0x27D4EB2F165667C5ULL
+
+static inline uint64_t rotl64(uint64_t x, int r)
+{
+    return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t read64(const unsigned char *p)
+{
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint32_t read32(const unsigned char *p)
+{
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint64_t xxh64_round(uint64_t acc, uint64_t input)
+{
+    acc += input * PRIME64_2;
+    acc = rotl64(acc, 31);
+    return acc * PRIME64_1;
+}
+
+static inline uint64_t xxh64_merge(uint64_t acc, uint64_t val)
+{
+    acc ^= xxh64_round(0, val);
+    return acc * PRIME64_1 + PRIME64_4;
+}
+
+uint64_t xxh64(const void *input, size_t len, uint64_t seed)
+{
+    const unsigned char *p = (const unsigned char *)input;
+    const unsigned char *end = p + len;
+    uint64_t h;
+
+    if (len >= 32)
+    {
+        uint64_t v1 = seed + PRIME64_1 + PRIME64_2;
+        uint64_t v2 = seed + PRIME64_2;
+        uint64_t v3 = seed;
+        uint64_t v4 = seed - PRIME64_1;
+
+        while (p + 32 <= end)
+        {
+            v1 = xxh64_round(v1, read64(p));
+            v2 = xxh64_round(v2, read64(p + 8));
+            v3 = xxh64_round(v3, read64(p + 16));
+            v4 = xxh64_round(v4, read64(p + 24));
+            p += 32;
+        }
+
+        h = rotl64(v1, 1) + rotl64(v2, 7) + rotl64(v3, 12) + rotl64(v4, 18);
+        h = xxh64_merge(h, v1);
+        h = xxh64_merge(h, v2);
+        h = xxh64_merge(h, v3);
+        h = xxh64_merge(h, v4);
+    }
+    else
+    {
+        h = seed + PRIME64_5;
+    }
+
+    h += (uint64_t)len;
+
+    while (p + 8 <= end)
+    {
+        h ^= xxh64_round(0, read64(p));
+        h = rotl64(h, 27) * PRIME64_1 + PRIME64_4;
+        p += 8;
+    }
+
+    if (p + 4 <= end)
+    {
+        h ^= (uint64_t)read32(p) * PRIME64_1;
+        h = rotl64(h, 23) * PRIME64_2 + PRIME64_3;
+        p += 4;
+    }
+
+    while (p < end)
+    {
+        h ^= (*p) * PRIME64_5;
+        h = rotl64(h, 11) * PRIME64_1;
+        p++;
+    }
+
+    h ^= h >> 33;
+    h *= PRIME64_2;
+    h ^= h >> 29;
+    h *= PRIME64_3;
+    h ^= h >> 32;
+
+    return h;
+}
+
+// Hash of the image rows [row0, row1), the rows being image->y pixels long.
+uint64_t digest_rows(ppm_image *image, int row0, int row1)
+{
+    size_t offset = (size_t)row0 * image->y;
+    size_t len = (size_t)(row1 - row0) * image->y * sizeof(ppm_pixel);
+
+    return xxh64(image->data + offset, len, 0);
+}
+
+// Combines the band hashes, in band order, together with the image size. The bands depend only
+// on the image, so the result is the same for any number of threads.
+uint64_t digest_combine(uint64_t *band_hashes, int count, int x, int y)
+{
+    uint64_t size = ((uint64_t)(uint32_t)x << 32) | (uint32_t)y;
+    uint64_t bands = xxh64(band_hashes, (size_t)count * sizeof(uint64_t), 0);
+
+    return xxh64(&size, sizeof(size), bands);
+}
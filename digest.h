@@ -0,0 +1,10 @@
+#ifndef DIGEST_H
+#define DIGEST_H
+
+#include "helpers.h"
+
+uint64_t xxh64(const void *input, size_t len, uint64_t seed);
+uint64_t digest_rows(ppm_image *image, int row0, int row1);
+uint64_t digest_combine(uint64_t *band_hashes, int count, int x, int y);
+
+#endif
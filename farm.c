@@ -0,0 +1,353 @@
+#include "farm.h"
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+static void farm_dir(const char *root, const char *name, char path[PATH_MAX])
+{
+    if (snprintf(path, PATH_MAX, "%s/%s", root, name) >= PATH_MAX)
+    {
+        fprintf(stderr, "Path too long for '%s'\n", root);
+        exit(1);
+    }
+
+    // every node creates the layout, the first one wins
+    if (mkdir(path, 0755) && errno != EEXIST)
+    {
+        fprintf(stderr, "Unable to create directory '%s'\n", path);
+        exit(1);
+    }
+}
+
+// Returns -1 if the path does not fit.
+static int farm_path(const char *dir, const char *name, char path[PATH_MAX])
+{
+    return snprintf(path, PATH_MAX, "%s/%s", dir, name) >= PATH_MAX ? -1 : 0;
+}
+
+static int is_job(const char *name)
+{
+    size_t length = strlen(name);
+    return name[0] != '.' && length > 4 && !strcmp(name + length - 4, ".ppm");
+}
+
+// Reads the node that wrote a lease. Returns -1 if there is no lease.
+static int read_lease(const char *path, char owner[FARM_NODE_SIZE])
+{
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+    {
+        return -1;
+    }
+
+    ssize_t length = read(fd, owner, FARM_NODE_SIZE - 1);
+    owner[length > 0 ? length : 0] = '\0';
+    close(fd);
+    return 0;
+}
+
+static int owns_lease(farm *f, const char *path)
+{
+    char owner[FARM_NODE_SIZE];
+    return !read_lease(path, owner) && !strcmp(owner, f->node);
+}
+
+// Writes a new lease for a job this node just claimed, replacing the one of a node that lost it.
+static void write_lease(farm *f, const char *name)
+{
+    char path[PATH_MAX];
+
+    if (farm_path(f->leases, name, path))
+    {
+        return;
+    }
+
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0 || write(fd, f->node, strlen(f->node)) < 0)
+    {
+        fprintf(stderr, "Unable to write lease '%s'\n", path);
+    }
+    if (fd >= 0)
+    {
+        close(fd);
+    }
+}
+
+// Sets the time of a lease to now, as long as it is still ours: once the job was requeued the
+// lease is gone or belongs to the node that claimed it next, and must be left alone.
+static void touch_lease(farm *f, const char *name)
+{
+    char path[PATH_MAX];
+
+    if (farm_path(f->leases, name, path) || !owns_lease(f, path))
+    {
+        return;
+    }
+
+    if (utimensat(AT_FDCWD, path, NULL, 0))
+    {
+        fprintf(stderr, "Unable to touch lease '%s'\n", path);
+    }
+}
+
+static void *heartbeat_thread(void *arg)
+{
+    farm *f = (farm *)arg;
+    struct timespec deadline;
+
+    pthread_mutex_lock(&f->lock);
+    while (!f->stop)
+    {
+        for (int k = 0; k < FARM_IN_FLIGHT; k++)
+        {
+            if (f->held[k][0])
+            {
+                touch_lease(f, f->held[k]);
+            }
+        }
+
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += f->lease / 3 > 0 ? f->lease / 3 : 1;
+        pthread_cond_timedwait(&f->wake, &f->lock, &deadline);
+    }
+    pthread_mutex_unlock(&f->lock);
+
+    return NULL;
+}
+
+farm *farm_open(const char *root, int lease)
+{
+    farm *f = (farm *)calloc(1, sizeof(farm));
+    if (!f)
+    {
+        fprintf(stderr, "Unable to allocate memory\n");
+        exit(1);
+    }
+
+    farm_dir(root, "todo", f->todo);
+    farm_dir(root, "claimed", f->claimed);
+    farm_dir(root, "leases", f->leases);
+    farm_dir(root, "done", f->done);
+    farm_dir(root, "failed", f->failed);
+
+    char host[64] = "unknown";
+    gethostname(host, sizeof(host) - 1);
+    snprintf(f->node, sizeof(f->node), "%s %d\n", host, (int)getpid());
+
+    f->lease = lease;
+    f->seed = (unsigned int)getpid() ^ (unsigned int)time(NULL);
+    pthread_mutex_init(&f->lock, NULL);
+    pthread_cond_init(&f->wake, NULL);
+    pthread_create(&f->heartbeat, NULL, heartbeat_thread, f);
+
+    return f;
+}
+
+// Claims one job of todo/ into `name`. The scan starts at a random entry, so nodes that list the
+// directory in the same order rarely race for the same file. Returns 0 if todo/ has no job left.
+int farm_claim(farm *f, char name[NAME_MAX + 1])
+{
+    DIR *dir = opendir(f->todo);
+    if (!dir)
+    {
+        fprintf(stderr, "Unable to open directory '%s'\n", f->todo);
+        exit(1);
+    }
+
+    char (*names)[NAME_MAX + 1] = NULL;
+    int count = 0, capacity = 0;
+    struct dirent *entry;
+
+    while ((entry = readdir(dir)))
+    {
+        if (!is_job(entry->d_name))
+        {
+            continue;
+        }
+        if (count == capacity)
+        {
+            capacity = capacity ? 2 * capacity : 64;
+            names = realloc(names, capacity * sizeof(*names));
+            if (!names)
+            {
+                fprintf(stderr, "Unable to allocate memory\n");
+                exit(1);
+            }
+        }
+        strcpy(names[count++], entry->d_name);
+    }
+    closedir(dir);
+
+    int claimed = 0;
+    int start = count ? rand_r(&f->seed) % count : 0;
+    for (int k = 0; k < count && !claimed; k++)
+    {
+        char from[PATH_MAX], to[PATH_MAX];
+        const char *candidate = names[(start + k) % count];
+
+        if (farm_path(f->todo, candidate, from) || farm_path(f->claimed, candidate, to))
+        {
+            continue;
+        }
+
+        // only one node gets the file, the others find it gone
+        if (!rename(from, to))
+        {
+            strcpy(name, candidate);
+            write_lease(f, name);
+
+            pthread_mutex_lock(&f->lock);
+            for (int h = 0; h < FARM_IN_FLIGHT; h++)
+            {
+                if (!f->held[h][0])
+                {
+                    strcpy(f->held[h], name);
+                    break;
+                }
+            }
+            pthread_mutex_unlock(&f->lock);
+            claimed = 1;
+        }
+    }
+
+    free(names);
+    return claimed;
+}
+
+// Moves the claimed jobs whose lease expired back to todo/. A job that has no lease yet is
+// judged by the time it was claimed, as rename() updates the change time of the file. Returns
+// the number of jobs other nodes still hold plus the ones just moved back to todo/, so a caller
+// that sees 0 knows no job can appear in todo/ any more.
+int farm_requeue_expired(farm *f)
+{
+    DIR *dir = opendir(f->claimed);
+    if (!dir)
+    {
+        fprintf(stderr, "Unable to open directory '%s'\n", f->claimed);
+        exit(1);
+    }
+
+    int live = 0, requeued = 0;
+    time_t now = time(NULL);
+    struct dirent *entry;
+
+    while ((entry = readdir(dir)))
+    {
+        char job[PATH_MAX], lease[PATH_MAX], back[PATH_MAX];
+        struct stat st;
+        int held = 0;
+
+        if (!is_job(entry->d_name) || farm_path(f->claimed, entry->d_name, job) ||
+            farm_path(f->leases, entry->d_name, lease) || farm_path(f->todo, entry->d_name, back))
+        {
+            continue;
+        }
+
+        pthread_mutex_lock(&f->lock);
+        for (int h = 0; h < FARM_IN_FLIGHT; h++)
+        {
+            held |= !strcmp(f->held[h], entry->d_name);
+        }
+        pthread_mutex_unlock(&f->lock);
+        if (held)
+        {
+            continue;
+        }
+
+        char owner[FARM_NODE_SIZE];
+        time_t last;
+        if (!read_lease(lease, owner) && !stat(lease, &st))
+        {
+            last = st.st_mtime;
+        }
+        else if (!stat(job, &st))
+        {
+            owner[0] = '\0';
+            last = st.st_ctime;
+        }
+        else
+        {
+            // completed or requeued meanwhile
+            continue;
+        }
+
+        if (now - last <= f->lease)
+        {
+            live++;
+        }
+        else if (!rename(job, back))
+        {
+            // the job may already have been claimed again, whose lease must stay
+            char current[FARM_NODE_SIZE];
+            if (owner[0] && !read_lease(lease, current) && !strcmp(current, owner))
+            {
+                unlink(lease);
+            }
+            fprintf(stderr, "Requeued '%s', its lease expired\n", entry->d_name);
+            requeued++;
+        }
+    }
+    closedir(dir);
+
+    return live + requeued;
+}
+
+// Moves a claimed job to `dir` and releases it. Returns -1 if its lease was lost: another node
+// requeued the job and may have claimed it again, so neither the file in claimed/ nor the lease
+// are ours to move.
+static int finish_job(farm *f, const char *name, const char *dir)
+{
+    char from[PATH_MAX], to[PATH_MAX], lease[PATH_MAX];
+    int lost = farm_path(f->claimed, name, from) || farm_path(dir, name, to) ||
+               farm_path(f->leases, name, lease) || !owns_lease(f, lease) || rename(from, to);
+
+    pthread_mutex_lock(&f->lock);
+    for (int h = 0; h < FARM_IN_FLIGHT; h++)
+    {
+        if (!strcmp(f->held[h], name))
+        {
+            f->held[h][0] = '\0';
+        }
+    }
+    pthread_mutex_unlock(&f->lock);
+
+    if (lost)
+    {
+        return -1;
+    }
+    unlink(lease);
+    return 0;
+}
+
+// Moves a job to done/. Returns -1 if its lease was lost and another node requeued it, in which
+// case the job will simply be contoured again.
+int farm_complete(farm *f, const char *name)
+{
+    return finish_job(f, name, f->done);
+}
+
+// Moves a job that cannot be processed to failed/, so it does not go back to todo/ and take
+// down the next node that claims it.
+int farm_fail(farm *f, const char *name)
+{
+    return finish_job(f, name, f->failed);
+}
+
+void farm_close(farm *f)
+{
+    pthread_mutex_lock(&f->lock);
+    f->stop = 1;
+    pthread_cond_signal(&f->wake);
+    pthread_mutex_unlock(&f->lock);
+
+    pthread_join(f->heartbeat, NULL);
+    pthread_mutex_destroy(&f->lock);
+    pthread_cond_destroy(&f->wake);
+    free(f);
+}
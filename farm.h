@@ -0,0 +1,43 @@
+#ifndef FARM_H
+#define FARM_H
+
+#include <limits.h>
+#include <pthread.h>
+
+// Seconds after its last heartbeat that a claimed job is handed to another node.
+#define FARM_LEASE_SECONDS  30
+// Jobs a node keeps claimed at once: one being contoured while the next one is read.
+#define FARM_IN_FLIGHT      2
+// Bytes of the "host pid" line that identifies a node in its leases.
+#define FARM_NODE_SIZE      96
+
+// Batch farm over a shared directory, without a coordinator:
+//     todo/       .ppm files waiting for a node
+//     claimed/    files claimed by a node, moved here from todo/ with rename()
+//     leases/     one file per claimed job holding the owner ("host pid"), touched by the owner
+//                 every lease / 3 seconds
+//     done/       files whose contour was written
+//     failed/     files that could not be read as an image, set aside so no node takes them again
+// rename() succeeds for exactly one of the nodes racing for a file, and a job whose lease
+// expired is moved back to todo/ by whichever node notices it first.
+typedef struct farm
+{
+    char todo[PATH_MAX], claimed[PATH_MAX], leases[PATH_MAX], done[PATH_MAX], failed[PATH_MAX];
+    int lease;
+    char node[FARM_NODE_SIZE];
+    unsigned int seed;
+    char held[FARM_IN_FLIGHT][NAME_MAX + 1];
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    int stop;
+    pthread_t heartbeat;
+} farm;
+
+farm *farm_open(const char *root, int lease);
+int farm_claim(farm *f, char name[NAME_MAX + 1]);
+int farm_requeue_expired(farm *f);
+int farm_complete(farm *f, const char *name);
+int farm_fail(farm *f, const char *name);
+void farm_close(farm *f);
+
+#endif
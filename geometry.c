@@ -0,0 +1,353 @@
+#include "geometry.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#define CLAMP(v, min, max) if(v < min) { v = min; } else if(v > max) { v = max; }
+
+// Longest varint of a 32-bit value.
+#define VARINT_MAX 5
+
+// (row, column) steps between consecutive points, indexed by their 4-bit code.
+static const int geometry_steps[8][2] = {
+    {-1, -1}, {-1, 1}, {1, -1}, {1, 1}, {-2, 0}, {2, 0}, {0, -2}, {0, 2},
+};
+
+static void *geometry_alloc(size_t size)
+{
+    void *ptr = malloc(size ? size : 1);
+    if (!ptr)
+    {
+        fprintf(stderr, "Unable to allocate memory\n");
+        exit(1);
+    }
+    return ptr;
+}
+
+static unsigned char *put_varint(unsigned char *out, uint32_t value)
+{
+    while (value >= 0x80)
+    {
+        *out++ = (unsigned char)(value | 0x80);
+        value >>= 7;
+    }
+    *out++ = (unsigned char)value;
+    return out;
+}
+
+// Returns NULL if the varint runs past `end`.
+static const unsigned char *get_varint(const unsigned char *in, const unsigned char *end, uint32_t *value)
+{
+    *value = 0;
+    for (int shift = 0; in < end && shift < 7 * VARINT_MAX; shift += 7)
+    {
+        unsigned char byte = *in++;
+        *value |= (uint32_t)(byte & 0x7f) << shift;
+        if (!(byte & 0x80))
+        {
+            return in;
+        }
+    }
+    return NULL;
+}
+
+static int step_code(const int32_t *from, const int32_t *to)
+{
+    for (int k = 0; k < 8; k++)
+    {
+        if (to[0] - from[0] == geometry_steps[k][0] && to[1] - from[1] == geometry_steps[k][1])
+        {
+            return k;
+        }
+    }
+
+    fprintf(stderr, "Polyline points are not one cell side apart\n");
+    exit(1);
+}
+
+// Creates the file; the header and the footer are only written by geometry_close(), once the
+// size of every chunk is known.
+geometry_writer *geometry_create(const char *filename, int bands)
+{
+    geometry_writer *gw = (geometry_writer *)geometry_alloc(sizeof(geometry_writer));
+
+    gw->fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (gw->fd < 0)
+    {
+        fprintf(stderr, "Unable to open file '%s'\n", filename);
+        exit(1);
+    }
+
+    gw->bands = bands;
+    gw->chunks = (unsigned char **)calloc(bands, sizeof(unsigned char *));
+    gw->index = (geometry_entry *)calloc(bands, sizeof(geometry_entry));
+    if (!gw->chunks || !gw->index)
+    {
+        fprintf(stderr, "Unable to allocate memory\n");
+        exit(1);
+    }
+
+    return gw;
+}
+
+// Encodes the chains that trace_band() found in `band` into a chunk in memory.
+void geometry_encode_band(geometry_writer *gw, polygon_set *ps, int band)
+{
+    polygon_band *pb = &ps->bands[band];
+    size_t bound = VARINT_MAX;
+
+    for (int c = 0; c < pb->chain_count; c++)
+    {
+        bound += 3 * VARINT_MAX + 1 + pb->chains[c].count / 2 + 1;
+    }
+
+    unsigned char *chunk = (unsigned char *)geometry_alloc(bound);
+    unsigned char *out = put_varint(chunk, pb->chain_count);
+
+    for (int c = 0; c < pb->chain_count; c++)
+    {
+        chain *ch = &pb->chains[c];
+        int32_t *points = &pb->points[2 * ch->first];
+
+        out = put_varint(out, ch->count);
+        *out++ = (unsigned char)ch->closed;
+        out = put_varint(out, points[0]);
+        out = put_varint(out, points[1]);
+
+        for (int i = 1; i < ch->count; i += 2)
+        {
+            unsigned char byte = step_code(&points[2 * (i - 1)], &points[2 * i]);
+            if (i + 1 < ch->count)
+            {
+                byte |= step_code(&points[2 * i], &points[2 * (i + 1)]) << 4;
+            }
+            *out++ = byte;
+        }
+    }
+
+    gw->chunks[band] = chunk;
+    gw->index[band].size = out - chunk;
+    gw->index[band].polylines = pb->chain_count;
+}
+
+// Lays the chunks out one after the other. Done by a single thread, once every chunk is encoded.
+void geometry_place(geometry_writer *gw)
+{
+    uint64_t offset = GEOMETRY_HEADER_SIZE;
+
+    for (int b = 0; b < gw->bands; b++)
+    {
+        gw->index[b].offset = offset;
+        offset += gw->index[b].size;
+    }
+}
+
+void geometry_write_band(geometry_writer *gw, int band)
+{
+    geometry_entry *entry = &gw->index[band];
+
+    if (pwrite(gw->fd, gw->chunks[band], entry->size, entry->offset) != (ssize_t)entry->size)
+    {
+        fprintf(stderr, "Unable to write geometry chunk %d\n", band);
+        exit(1);
+    }
+
+    free(gw->chunks[band]);
+    gw->chunks[band] = NULL;
+}
+
+void geometry_close(geometry_writer *gw, polygon_set *ps)
+{
+    uint32_t header[4];
+    unsigned char trailer[GEOMETRY_TRAILER_SIZE];
+    uint32_t bands = gw->bands;
+    uint64_t footer = gw->bands ? gw->index[gw->bands - 1].offset + gw->index[gw->bands - 1].size
+                                : GEOMETRY_HEADER_SIZE;
+    size_t index_size = gw->bands * sizeof(geometry_entry);
+
+    memcpy(&header[0], GEOMETRY_MAGIC, 4);
+    header[1] = STEP;
+    header[2] = ps->p;
+    header[3] = ps->q;
+
+    memcpy(trailer, &bands, 4);
+    memcpy(trailer + 4, &footer, 8);
+    memcpy(trailer + 12, GEOMETRY_MAGIC, 4);
+
+    if (pwrite(gw->fd, header, GEOMETRY_HEADER_SIZE, 0) != GEOMETRY_HEADER_SIZE ||
+        pwrite(gw->fd, gw->index, index_size, footer) != (ssize_t)index_size ||
+        pwrite(gw->fd, trailer, GEOMETRY_TRAILER_SIZE, footer + index_size) != GEOMETRY_TRAILER_SIZE)
+    {
+        fprintf(stderr, "Unable to write geometry file\n");
+        exit(1);
+    }
+
+    close(gw->fd);
+    for (int b = 0; b < gw->bands; b++)
+    {
+        free(gw->chunks[b]);
+    }
+    free(gw->chunks);
+    free(gw->index);
+    free(gw);
+}
+
+// Reads the header and the footer index; the chunks are only read on demand.
+geometry_file *geometry_open(const char *filename)
+{
+    uint32_t header[4];
+    unsigned char trailer[GEOMETRY_TRAILER_SIZE];
+    struct stat st;
+    geometry_file *gf = (geometry_file *)geometry_alloc(sizeof(geometry_file));
+
+    gf->fd = open(filename, O_RDONLY);
+    if (gf->fd < 0 || fstat(gf->fd, &st))
+    {
+        fprintf(stderr, "Unable to open file '%s'\n", filename);
+        exit(1);
+    }
+
+    uint32_t bands;
+    uint64_t footer;
+    if (st.st_size < GEOMETRY_HEADER_SIZE + GEOMETRY_TRAILER_SIZE ||
+        pread(gf->fd, header, GEOMETRY_HEADER_SIZE, 0) != GEOMETRY_HEADER_SIZE ||
+        pread(gf->fd, trailer, GEOMETRY_TRAILER_SIZE, st.st_size - GEOMETRY_TRAILER_SIZE) != GEOMETRY_TRAILER_SIZE ||
+        memcmp(&header[0], GEOMETRY_MAGIC, 4) || memcmp(trailer + 12, GEOMETRY_MAGIC, 4) || header[1] != STEP)
+    {
+        fprintf(stderr, "Invalid geometry file '%s'\n", filename);
+        exit(1);
+    }
+
+    memcpy(&bands, trailer, 4);
+    memcpy(&footer, trailer + 4, 8);
+
+    size_t index_size = (size_t)bands * sizeof(geometry_entry);
+    if (footer + index_size + GEOMETRY_TRAILER_SIZE != (uint64_t)st.st_size)
+    {
+        fprintf(stderr, "Invalid geometry file '%s'\n", filename);
+        exit(1);
+    }
+
+    gf->p = header[2];
+    gf->q = header[3];
+    gf->bands = bands;
+    gf->index = (geometry_entry *)geometry_alloc(index_size);
+    if (pread(gf->fd, gf->index, index_size, footer) != (ssize_t)index_size)
+    {
+        fprintf(stderr, "Invalid geometry file '%s'\n", filename);
+        exit(1);
+    }
+
+    return gf;
+}
+
+// Decodes the polylines of one band into a newly allocated array. Returns their number, or -1
+// if the chunk is missing or corrupt.
+int geometry_read_band(geometry_file *gf, int band, geometry_polyline **out)
+{
+    if (band < 0 || band >= gf->bands)
+    {
+        return -1;
+    }
+
+    geometry_entry *entry = &gf->index[band];
+    unsigned char *chunk = (unsigned char *)geometry_alloc(entry->size);
+    if (pread(gf->fd, chunk, entry->size, entry->offset) != (ssize_t)entry->size)
+    {
+        free(chunk);
+        return -1;
+    }
+
+    const unsigned char *in = chunk;
+    const unsigned char *end = chunk + entry->size;
+    uint32_t count;
+
+    in = get_varint(in, end, &count);
+    if (!in || count != entry->polylines)
+    {
+        free(chunk);
+        return -1;
+    }
+
+    geometry_polyline *lines = (geometry_polyline *)calloc(count ? count : 1, sizeof(geometry_polyline));
+    if (!lines)
+    {
+        fprintf(stderr, "Unable to allocate memory\n");
+        exit(1);
+    }
+
+    for (uint32_t l = 0; l < count; l++)
+    {
+        uint32_t n, row, col;
+
+        in = get_varint(in, end, &n);
+        if (!in || n == 0 || in >= end)
+        {
+            geometry_free_polylines(lines, l);
+            free(chunk);
+            return -1;
+        }
+        lines[l].closed = *in++;
+        in = get_varint(in, end, &row);
+        in = in ? get_varint(in, end, &col) : NULL;
+        if (!in || (size_t)(end - in) < n / 2)
+        {
+            geometry_free_polylines(lines, l);
+            free(chunk);
+            return -1;
+        }
+
+        int32_t *points = (int32_t *)geometry_alloc(2 * (size_t)n * sizeof(int32_t));
+        points[0] = row;
+        points[1] = col;
+        for (uint32_t i = 1; i < n; i++)
+        {
+            int code = (i % 2 ? in[(i - 1) / 2] : in[(i - 1) / 2] >> 4) & 0x0f;
+            if (code >= 8)
+            {
+                free(points);
+                geometry_free_polylines(lines, l);
+                free(chunk);
+                return -1;
+            }
+            points[2 * i] = points[2 * (i - 1)] + geometry_steps[code][0];
+            points[2 * i + 1] = points[2 * i - 1] + geometry_steps[code][1];
+        }
+        in += n / 2;
+
+        lines[l].count = n;
+        lines[l].points = points;
+    }
+
+    free(chunk);
+    *out = lines;
+    return count;
+}
+
+// Converts a point to pixels of the contour image, as written by write_polygons().
+void geometry_pixel(geometry_file *gf, const int32_t point[2], int *x, int *y)
+{
+    *x = (point[1] - 2) * STEP / 2;
+    *y = (point[0] - 2) * STEP / 2;
+    CLAMP(*x, 0, gf->q * STEP);
+    CLAMP(*y, 0, gf->p * STEP);
+}
+
+void geometry_free_polylines(geometry_polyline *lines, int count)
+{
+    for (int l = 0; l < count; l++)
+    {
+        free(lines[l].points);
+    }
+    free(lines);
+}
+
+void geometry_free(geometry_file *gf)
+{
+    close(gf->fd);
+    free(gf->index);
+    free(gf);
+}
@@ -0,0 +1,65 @@
+#ifndef GEOMETRY_H
+#define GEOMETRY_H
+
+#include "helpers.h"
+#include "polygon.h"
+
+// Binary contour geometry. Every band of cell rows is one chunk, written by its own thread:
+//     "CGEO" STEP p q                                  (uint32, host byte order)
+//     chunk 0 .. chunk bands - 1
+//     bands * geometry_entry                           (the footer index)
+//     bands footer_offset "CGEO"                       (uint32, uint64, 4 bytes)
+// A chunk is a varint polyline count followed by the polylines of the band:
+//     varint n, byte closed, varint row, varint column, ceil((n - 1) / 2) bytes of steps
+// Coordinates are edge midpoints of the padded grid in half cells (see polygon.c). Consecutive
+// points of a polyline are always one cell side apart, so every point after the first is one of
+// 8 steps, stored as a 4-bit code, two per byte. Closed polylines do not repeat their first
+// point; open ones continue in the polyline of the next band that starts or ends on the same
+// point.
+#define GEOMETRY_MAGIC          "CGEO"
+#define GEOMETRY_HEADER_SIZE    16
+#define GEOMETRY_TRAILER_SIZE   16
+
+typedef struct geometry_entry
+{
+    uint64_t offset;
+    uint32_t size;
+    uint32_t polylines;
+} geometry_entry;
+
+typedef struct geometry_writer
+{
+    int fd;
+    int bands;
+    unsigned char **chunks;
+    geometry_entry *index;
+} geometry_writer;
+
+typedef struct geometry_polyline
+{
+    int count;
+    int closed;
+    int32_t *points;        // (row, column) pairs in half cells
+} geometry_polyline;
+
+typedef struct geometry_file
+{
+    int fd;
+    int p, q;
+    int bands;
+    geometry_entry *index;
+} geometry_file;
+
+geometry_writer *geometry_create(const char *filename, int bands);
+void geometry_encode_band(geometry_writer *gw, polygon_set *ps, int band);
+void geometry_place(geometry_writer *gw);
+void geometry_write_band(geometry_writer *gw, int band);
+void geometry_close(geometry_writer *gw, polygon_set *ps);
+
+geometry_file *geometry_open(const char *filename);
+int geometry_read_band(geometry_file *gf, int band, geometry_polyline **out);
+void geometry_pixel(geometry_file *gf, const int32_t point[2], int *x, int *y);
+void geometry_free_polylines(geometry_polyline *lines, int count);
+void geometry_free(geometry_file *gf);
+
+#endif
@@ -6,46 +6,45 @@
 #include <unistd.h>
 #include <string.h>
 #include <math.h>
+#include <sys/stat.h>
 
 #define CLAMP(v, min, max) if(v < min) { v = min; } else if(v > max) { v = max; }
 
 // Source: [1]
-ppm_image *read_ppm(const char *filename) {
+// Returns 0 on success, -1 if nothing but whitespace is left and -2 (after printing why) if the
+// header is not a valid 8-bit P6 header.
+static int parse_ppm_header(FILE *fp, const char *filename, int *x, int *y) {
     char buff[16];
-    ppm_image *img;
-    FILE *fp;
     int c, rgb_comp_color;
 
-    // open PPM file for reading
-    fp = fopen(filename, "rb");
-    if (!fp) {
-        fprintf(stderr, "Unable to open file '%s'\n", filename);
-        exit(1);
+    // images in a stream may be separated by whitespace; nothing else left means the stream ended
+    c = getc(fp);
+    while (c == ' ' || c == '\t' || c == '\n' || c == '\r') {
+        c = getc(fp);
     }
 
+    if (c == EOF) {
+        return -1;
+    }
+
+    ungetc(c, fp);
+
     // read image format
     if (!fgets(buff, sizeof(buff), fp)) {
         perror(filename);
-        exit(1);
+        return -2;
     }
 
     // check the image format
     if (buff[0] != 'P' || buff[1] != '6') {
         fprintf(stderr, "Invalid image format (must be 'P6')\n");
-        exit(1);
-    }
-
-    // alloc memory for image
-    img = (ppm_image *)malloc(sizeof(ppm_image));
-    if (!img) {
-        fprintf(stderr, "Unable to allocate memory\n");
-        exit(1);
+        return -2;
     }
 
     // check for comments
     c = getc(fp);
     while (c == '#') {
-        while (getc(fp) != '\n');
+        while ((c = getc(fp)) != '\n' && c != EOF);
 
         c = getc(fp);
     }
@@ -53,54 +52,254 @@ ppm_image *read_ppm(const char *filename) {
     ungetc(c, fp);
 
     // read image size information
-    if (fscanf(fp, "%d %d", &img->x, &img->y) != 2) {
+    if (fscanf(fp, "%d %d", x, y) != 2 || *x <= 0 || *y <= 0) {
         fprintf(stderr, "Invalid image size (error loading '%s')\n", filename);
-        exit(1);
+        return -2;
     }
 
     // read RGB component
     if (fscanf(fp, "%d", &rgb_comp_color) != 1) {
         fprintf(stderr, "Invalid rgb component (error loading '%s')\n", filename);
-        exit(1);
+        return -2;
     }
 
     // check RGB component depth
     if (rgb_comp_color != RGB_COMPONENT_COLOR) {
         fprintf(stderr, "'%s' does not have 8-bits components\n", filename);
+        return -2;
+    }
+
+    c = fgetc(fp);
+    while (c != '\n' && c != EOF) {
+        c = fgetc(fp);
+    }
+
+    return 0;
+}
+
+// Returns 0 after a header, -1 at the end of the stream and exits on an invalid header.
+int read_ppm_header(FILE *fp, const char *filename, int *x, int *y) {
+    int ret = parse_ppm_header(fp, filename, x, y);
+    if (ret == -2) {
         exit(1);
     }
 
-    while (fgetc(fp) != '\n') ;
+    return ret;
+}
 
-    // memory allocation for pixel data
-    img->data = (ppm_pixel*)malloc(img->x * img->y * sizeof(ppm_pixel));
+FILE *open_ppm(const char *filename, int *x, int *y) {
+    FILE *fp;
 
-    if (!img) {
-        fprintf(stderr, "Unable to allocate memory\n");
+    // open PPM file for reading
+    fp = fopen(filename, "rb");
+    if (!fp) {
+        fprintf(stderr, "Unable to open file '%s'\n", filename);
+        exit(1);
+    }
+
+    if (read_ppm_header(fp, filename, x, y)) {
+        fprintf(stderr, "Empty file '%s'\n", filename);
         exit(1);
     }
 
+    return fp;
+}
+
+// Reads the next image of a stream of concatenated PPM images. Returns NULL once the stream
+// has no more images.
+ppm_image *read_ppm_stream(FILE *fp, const char *filename) {
+    int x, y;
+
+    if (read_ppm_header(fp, filename, &x, &y)) {
+        return NULL;
+    }
+
+    ppm_image *img = allocate_image(x, y);
+
     // read pixel data from file
     if ((int)fread(img->data, 3 * img->x, img->y, fp) != img->y) {
         fprintf(stderr, "Error loading image '%s'\n", filename);
         exit(1);
     }
 
-    fclose(fp);
     return img;
 }
 
 // Source: [1]
-void write_ppm(ppm_image *img, const char *filename) {
+ppm_image *read_ppm(const char *filename) {
+    ppm_image *img;
     FILE *fp;
 
-    // open file for output
-    fp = fopen(filename, "wb");
+    // open PPM file for reading
+    fp = fopen(filename, "rb");
+    if (!fp) {
+        fprintf(stderr, "Unable to open file '%s'\n", filename);
+        exit(1);
+    }
+
+    img = read_ppm_stream(fp, filename);
+    if (!img) {
+        fprintf(stderr, "Empty file '%s'\n", filename);
+        exit(1);
+    }
+
+    fclose(fp);
+    return img;
+}
+
+// Like read_ppm(), but for inputs that may be missing, truncated or not images at all (files
+// dropped into a watched directory, farm jobs): prints why and returns NULL instead of exiting.
+ppm_image *try_read_ppm(const char *filename) {
+    struct stat st;
+    int x, y;
+
+    FILE *fp = fopen(filename, "rb");
+    if (!fp) {
+        fprintf(stderr, "Unable to open file '%s'\n", filename);
+        return NULL;
+    }
+
+    int ret = parse_ppm_header(fp, filename, &x, &y);
+    if (ret) {
+        if (ret == -1) {
+            fprintf(stderr, "Empty file '%s'\n", filename);
+        }
+        fclose(fp);
+        return NULL;
+    }
+
+    // a corrupt size must not turn into a huge allocation
+    if (fstat(fileno(fp), &st) || st.st_size - ftell(fp) < 3 * (off_t)x * y) {
+        fprintf(stderr, "Truncated image '%s'\n", filename);
+        fclose(fp);
+        return NULL;
+    }
+
+    ppm_image *img = allocate_image(x, y);
+    if ((int)fread(img->data, 3 * img->x, img->y, fp) != img->y) {
+        fprintf(stderr, "Error loading image '%s'\n", filename);
+        free(img->data);
+        free(img);
+        fclose(fp);
+        return NULL;
+    }
+
+    fclose(fp);
+    return img;
+}
+
+// Checks the magic number of a file without consuming it, to tell PBM masks from PPM images.
+int is_pbm(const char *filename) {
+    char magic[2];
+    FILE *fp = fopen(filename, "rb");
+
+    if (!fp) {
+        fprintf(stderr, "Unable to open file '%s'\n", filename);
+        exit(1);
+    }
+
+    int pbm = fread(magic, 1, 2, fp) == 2 && magic[0] == 'P' && magic[1] == '4';
+    fclose(fp);
+    return pbm;
+}
+
+pbm_mask *read_pbm(const char *filename) {
+    char buff[16];
+    pbm_mask *mask;
+    FILE *fp;
+    int c;
+
+    fp = fopen(filename, "rb");
     if (!fp) {
         fprintf(stderr, "Unable to open file '%s'\n", filename);
         exit(1);
     }
 
+    // read image format
+    if (!fgets(buff, sizeof(buff), fp)) {
+        perror(filename);
+        exit(1);
+    }
+
+    if (buff[0] != 'P' || buff[1] != '4') {
+        fprintf(stderr, "Invalid image format (must be 'P4')\n");
+        exit(1);
+    }
+
+    mask = (pbm_mask *)malloc(sizeof(pbm_mask));
+    if (!mask) {
+        fprintf(stderr, "Unable to allocate memory\n");
+        exit(1);
+    }
+
+    // check for comments
+    c = getc(fp);
+    while (c == '#') {
+        while ((c = getc(fp)) != '\n' && c != EOF);
+
+        if (c == EOF) {
+            fprintf(stderr, "Invalid header (error loading '%s')\n", filename);
+            exit(1);
+        }
+
+        c = getc(fp);
+    }
+
+    ungetc(c, fp);
+
+    // read image size information; P4 has no maximum value
+    if (fscanf(fp, "%d %d", &mask->x, &mask->y) != 2) {
+        fprintf(stderr, "Invalid image size (error loading '%s')\n", filename);
+        exit(1);
+    }
+
+    // a single whitespace character separates the header from the bits
+    fgetc(fp);
+
+    mask->row_bytes = (mask->x + 7) / 8;
+    mask->bits = (unsigned char *)malloc((size_t)mask->row_bytes * mask->y);
+    if (!mask->bits) {
+        fprintf(stderr, "Unable to allocate memory\n");
+        exit(1);
+    }
+
+    if ((int)fread(mask->bits, mask->row_bytes, mask->y, fp) != mask->y) {
+        fprintf(stderr, "Error loading image '%s'\n", filename);
+        exit(1);
+    }
+
+    fclose(fp);
+    return mask;
+}
+
+void free_pbm(pbm_mask *mask) {
+    free(mask->bits);
+    free(mask);
+}
+
+ppm_image *allocate_image(int x, int y) {
+    ppm_image *img;
+
+    // alloc memory for image
+    img = (ppm_image *)malloc(sizeof(ppm_image));
+    if (!img) {
+        fprintf(stderr, "Unable to allocate memory\n");
+        exit(1);
+    }
+
+    img->x = x;
+    img->y = y;
+    img->data = (ppm_pixel *)malloc((size_t)x * y * sizeof(ppm_pixel));
+    if (!img->data) {
+        fprintf(stderr, "Unable to allocate memory\n");
+        exit(1);
+    }
+
+    return img;
+}
+
+// Source: [1]
+void write_ppm_stream(ppm_image *img, FILE *fp) {
     // write the header file image format
     fprintf(fp, "P6\n");
 
@@ -112,6 +311,20 @@ void write_ppm(ppm_image *img, const char *filename) {
 
     // pixel data
     fwrite(img->data, 3 * img->x, img->y, fp);
+}
+
+// Source: [1]
+void write_ppm(ppm_image *img, const char *filename) {
+    FILE *fp;
+
+    // open file for output
+    fp = fopen(filename, "wb");
+    if (!fp) {
+        fprintf(stderr, "Unable to open file '%s'\n", filename);
+        exit(1);
+    }
+
+    write_ppm_stream(img, fp);
     fclose(fp);
 }
 
@@ -139,14 +352,21 @@ void get_pixel_clamped(ppm_image *source_image, int x, int y, uint8_t temp[]) {
 
 // Source: [2]
 void sample_bicubic(ppm_image *source_image, float u, float v, uint8_t sample[]) {
-    float x = (u * source_image->x) - 0.5;
+    sample_bicubic_band(source_image, source_image->y, 0, u, v, sample);
+}
+
+// Same as sample_bicubic, but `band` only holds the rows [row0, row0 + band->y) of an image
+// that is `full_y` rows high. The caller must make sure the 4-tap window is inside the band.
+void sample_bicubic_band(ppm_image *band, int full_y, int row0, float u, float v, uint8_t sample[]) {
+    float x = (u * band->x) - 0.5;
     int xint = (int)x;
     float xfract = x - floor(x);
 
-    float y = (v * source_image->y) - 0.5;
+    float y = (v * full_y) - 0.5;
     int yint = (int)y;
     float yfract = y - floor(y);
 
+    int rows[4];
     int i;
 
     uint8_t p00[3];
@@ -169,29 +389,36 @@ void sample_bicubic(ppm_image *source_image, float u, float v, uint8_t sample[])
     uint8_t p23[3];
     uint8_t p33[3];
 
+    // clamp against the full image, then make the rows relative to the band
+    for (i = 0; i < 4; i++) {
+        rows[i] = yint - 1 + i;
+        CLAMP(rows[i], 0, full_y - 1);
+        rows[i] -= row0;
+    }
+
     // 1st row
-    get_pixel_clamped(source_image, xint - 1, yint - 1, p00);
-    get_pixel_clamped(source_image, xint + 0, yint - 1, p10);
-    get_pixel_clamped(source_image, xint + 1, yint - 1, p20);
-    get_pixel_clamped(source_image, xint + 2, yint - 1, p30);
+    get_pixel_clamped(band, xint - 1, rows[0], p00);
+    get_pixel_clamped(band, xint + 0, rows[0], p10);
+    get_pixel_clamped(band, xint + 1, rows[0], p20);
+    get_pixel_clamped(band, xint + 2, rows[0], p30);
 
     // 2nd row
-    get_pixel_clamped(source_image, xint - 1, yint + 0, p01);
-    get_pixel_clamped(source_image, xint + 0, yint + 0, p11);
-    get_pixel_clamped(source_image, xint + 1, yint + 0, p21);
-    get_pixel_clamped(source_image, xint + 2, yint + 0, p31);
+    get_pixel_clamped(band, xint - 1, rows[1], p01);
+    get_pixel_clamped(band, xint + 0, rows[1], p11);
+    get_pixel_clamped(band, xint + 1, rows[1], p21);
+    get_pixel_clamped(band, xint + 2, rows[1], p31);
 
     // 3rd row
-    get_pixel_clamped(source_image, xint - 1, yint + 1, p02);
-    get_pixel_clamped(source_image, xint + 0, yint + 1, p12);
-    get_pixel_clamped(source_image, xint + 1, yint + 1, p22);
-    get_pixel_clamped(source_image, xint + 2, yint + 1, p32);
+    get_pixel_clamped(band, xint - 1, rows[2], p02);
+    get_pixel_clamped(band, xint + 0, rows[2], p12);
+    get_pixel_clamped(band, xint + 1, rows[2], p22);
+    get_pixel_clamped(band, xint + 2, rows[2], p32);
 
     // 4th row
-    get_pixel_clamped(source_image, xint - 1, yint + 2, p03);
-    get_pixel_clamped(source_image, xint + 0, yint + 2, p13);
-    get_pixel_clamped(source_image, xint + 1, yint + 2, p23);
-    get_pixel_clamped(source_image, xint + 2, yint + 2, p33);
+    get_pixel_clamped(band, xint - 1, rows[3], p03);
+    get_pixel_clamped(band, xint + 0, rows[3], p13);
+    get_pixel_clamped(band, xint + 1, rows[3], p23);
+    get_pixel_clamped(band, xint + 2, rows[3], p33);
 
     // interpolate bi-cubically
     for (i = 0; i < 3; i++) {
@@ -209,6 +436,38 @@ void sample_bicubic(ppm_image *source_image, float u, float v, uint8_t sample[])
     }
 }
 
+// Cheaper resampling tier: the 2x2 neighbourhood of the same sample point as sample_bicubic,
+// interpolated linearly. About a quarter of the loads and no cubic_hermite() calls.
+void sample_bilinear(ppm_image *source_image, float u, float v, uint8_t sample[]) {
+    float x = (u * source_image->x) - 0.5;
+    int xint = (int)x;
+    float xfract = x - floor(x);
+
+    float y = (v * source_image->y) - 0.5;
+    int yint = (int)y;
+    float yfract = y - floor(y);
+
+    uint8_t p00[3];
+    uint8_t p10[3];
+    uint8_t p01[3];
+    uint8_t p11[3];
+
+    get_pixel_clamped(source_image, xint + 0, yint + 0, p00);
+    get_pixel_clamped(source_image, xint + 1, yint + 0, p10);
+    get_pixel_clamped(source_image, xint + 0, yint + 1, p01);
+    get_pixel_clamped(source_image, xint + 1, yint + 1, p11);
+
+    for (int i = 0; i < 3; i++) {
+        float row0 = p00[i] + (p10[i] - p00[i]) * xfract;
+        float row1 = p01[i] + (p11[i] - p01[i]) * xfract;
+        float value = row0 + (row1 - row0) * yfract + 0.5f;
+
+        CLAMP(value, 0.0f, 255.0f);
+
+        sample[i] = (uint8_t)value;
+    }
+}
+
 // Sources:
 // [1] https://stackoverflow.com/questions/2693631/read-ppm-file-and-store-it-in-an-array-coded-with-c
 // [2] https://stackoverflow.com/questions/34622717/bicubic-interpolation-in-c
\ No newline at end of file
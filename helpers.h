@@ -3,6 +3,7 @@
 #ifndef HELPERS_H
 #define HELPERS_H
 
+#include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
 
@@ -23,10 +24,33 @@ typedef struct {
     ppm_pixel *data;
 } ppm_image;
 
+// A raw PBM (P4) image: one bit per pixel, 1 for black, rows padded to whole bytes.
+typedef struct {
+    int x, y;
+    int row_bytes;
+    unsigned char *bits;
+} pbm_mask;
+
+// Bit of the pixel at column `c` of row `r`.
+static inline int pbm_bit(pbm_mask *mask, int r, int c) {
+    return (mask->bits[(size_t)r * mask->row_bytes + (c >> 3)] >> (7 - (c & 7))) & 1;
+}
+
+int read_ppm_header(FILE *fp, const char *filename, int *x, int *y);
+FILE *open_ppm(const char *filename, int *x, int *y);
+ppm_image *read_ppm_stream(FILE *fp, const char *filename);
 ppm_image *read_ppm(const char *filename);
+ppm_image *try_read_ppm(const char *filename);
+int is_pbm(const char *filename);
+pbm_mask *read_pbm(const char *filename);
+void free_pbm(pbm_mask *mask);
+ppm_image *allocate_image(int x, int y);
+void write_ppm_stream(ppm_image *img, FILE *fp);
 void write_ppm(ppm_image *img, const char *filename);
 float cubic_hermite(float A, float B, float C, float D, float t);
 void get_pixel_clamped(ppm_image *source_image, int x, int y, uint8_t temp[]);
 void sample_bicubic(ppm_image *source_image, float u, float v, uint8_t sample[]);
+void sample_bilinear(ppm_image *source_image, float u, float v, uint8_t sample[]);
+void sample_bicubic_band(ppm_image *band, int full_y, int row0, float u, float v, uint8_t sample[]);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,141 @@
+#include "ingest.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+static void *read_rows(void *arg)
+{
+    row_source *source = (row_source *)arg;
+    ppm_image *image = source->image;
+
+    for (int row = 0; row < image->y; row += INGEST_CHUNK_ROWS)
+    {
+        int rows = image->y - row < INGEST_CHUNK_ROWS ? image->y - row : INGEST_CHUNK_ROWS;
+
+        if ((int)fread(image->data + (size_t)row * image->x, 3 * image->x, rows, source->fp) != rows)
+        {
+            fprintf(stderr, "Error loading image '%s'\n", source->filename);
+            exit(1);
+        }
+
+        pthread_mutex_lock(&source->lock);
+        __atomic_store_n(&source->rows_ready, row + rows, __ATOMIC_RELEASE);
+        pthread_cond_broadcast(&source->more_rows);
+        pthread_mutex_unlock(&source->lock);
+    }
+
+    fclose(source->fp);
+    return NULL;
+}
+
+// Parses the header, allocates the whole image and starts reading its rows in the background.
+row_source *open_row_source(const char *filename)
+{
+    row_source *source = (row_source *)malloc(sizeof(row_source));
+    if (!source)
+    {
+        fprintf(stderr, "Unable to allocate memory\n");
+        exit(1);
+    }
+
+    int x, y;
+    source->fp = open_ppm(filename, &x, &y);
+    source->image = allocate_image(x, y);
+    source->filename = strdup(filename);
+    source->rows_ready = 0;
+    pthread_mutex_init(&source->lock, NULL);
+    pthread_cond_init(&source->more_rows, NULL);
+
+    pthread_create(&source->reader, NULL, read_rows, source);
+    return source;
+}
+
+// Blocks until the first `rows` rows of the image have been read.
+void wait_rows(row_source *source, int rows)
+{
+    if (rows > source->image->y)
+    {
+        rows = source->image->y;
+    }
+
+    // fast path: no locking once the rows are there
+    if (__atomic_load_n(&source->rows_ready, __ATOMIC_ACQUIRE) >= rows)
+    {
+        return;
+    }
+
+    pthread_mutex_lock(&source->lock);
+    while (source->rows_ready < rows)
+    {
+        pthread_cond_wait(&source->more_rows, &source->lock);
+    }
+    pthread_mutex_unlock(&source->lock);
+}
+
+// Waits for the reader to finish; the image itself stays allocated.
+void close_row_source(row_source *source)
+{
+    pthread_join(source->reader, NULL);
+    pthread_mutex_destroy(&source->lock);
+    pthread_cond_destroy(&source->more_rows);
+    free(source->filename);
+    free(source);
+}
+
+// Parses the header and allocates the image without touching its pages, so that each page is
+// first touched (and placed on a NUMA node) by the worker that loads it.
+pread_source *open_pread_source(const char *filename)
+{
+    pread_source *source = (pread_source *)malloc(sizeof(pread_source));
+    if (!source)
+    {
+        fprintf(stderr, "Unable to allocate memory\n");
+        exit(1);
+    }
+
+    int x, y;
+    FILE *fp = open_ppm(filename, &x, &y);
+    source->offset = ftell(fp);
+    fclose(fp);
+
+    source->fd = open(filename, O_RDONLY);
+    if (source->fd < 0)
+    {
+        fprintf(stderr, "Unable to open file '%s'\n", filename);
+        exit(1);
+    }
+
+    source->image = allocate_image(x, y);
+    source->filename = strdup(filename);
+    return source;
+}
+
+// Reads the bytes [begin, end) of the payload straight into the image, PREAD_CHUNK at a time.
+// Safe to call from several threads on disjoint ranges.
+void pread_payload(pread_source *source, size_t begin, size_t end)
+{
+    char *data = (char *)source->image->data;
+
+    while (begin < end)
+    {
+        size_t len = end - begin < PREAD_CHUNK ? end - begin : PREAD_CHUNK;
+        ssize_t got = pread(source->fd, data + begin, len, source->offset + begin);
+
+        if (got <= 0)
+        {
+            fprintf(stderr, "Error loading image '%s'\n", source->filename);
+            exit(1);
+        }
+        begin += got;
+    }
+}
+
+// Closes the file; the image itself stays allocated.
+void close_pread_source(pread_source *source)
+{
+    close(source->fd);
+    free(source->filename);
+    free(source);
+}
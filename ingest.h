@@ -0,0 +1,45 @@
+#ifndef INGEST_H
+#define INGEST_H
+
+#include "helpers.h"
+#include <pthread.h>
+#include <sys/types.h>
+
+// Rows read by the background reader between two updates of the watermark.
+#define INGEST_CHUNK_ROWS 32
+
+// Bytes requested by a single pread() of the parallel loader.
+#define PREAD_CHUNK (8 << 20)
+
+// An image whose payload is loaded by the workers themselves, each with pread() calls on its
+// own part of the file.
+typedef struct pread_source
+{
+    ppm_image *image;
+    int fd;
+    off_t offset;
+    char *filename;
+} pread_source;
+
+// An image whose pixel rows are still being read by a background thread. rows_ready is the
+// watermark: rows [0, rows_ready) of image->data are complete.
+typedef struct row_source
+{
+    ppm_image *image;
+    FILE *fp;
+    char *filename;
+    int rows_ready;
+    pthread_mutex_t lock;
+    pthread_cond_t more_rows;
+    pthread_t reader;
+} row_source;
+
+row_source *open_row_source(const char *filename);
+void wait_rows(row_source *source, int rows);
+void close_row_source(row_source *source);
+
+pread_source *open_pread_source(const char *filename);
+void pread_payload(pread_source *source, size_t begin, size_t end);
+void close_pread_source(pread_source *source);
+
+#endif
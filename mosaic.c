@@ -0,0 +1,272 @@
+#include "mosaic.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MOSAIC_PATH_MAX 4096
+
+// Tile paths in the manifest are relative to the directory of the manifest itself.
+static char *tile_path(const char *manifest, const char *name)
+{
+    const char *slash = strrchr(manifest, '/');
+    int dir_len = (name[0] == '/' || !slash) ? 0 : (int)(slash - manifest) + 1;
+
+    char *path = (char *)malloc(dir_len + strlen(name) + 1);
+    if (!path)
+    {
+        fprintf(stderr, "Unable to allocate memory\n");
+        exit(1);
+    }
+
+    memcpy(path, manifest, dir_len);
+    strcpy(path + dir_len, name);
+    return path;
+}
+
+// Reads a manifest of the form
+//     <cols> <rows>
+//     <tile file> ... (cols * rows entries, in raster order)
+// and the headers of every tile. Tiles on the same row must share their height and tiles on
+// the same column must share their width, so together they cover a rectangle.
+mosaic *read_mosaic(const char *manifest)
+{
+    char name[MOSAIC_PATH_MAX];
+
+    FILE *fp = fopen(manifest, "r");
+    if (!fp)
+    {
+        fprintf(stderr, "Unable to open file '%s'\n", manifest);
+        exit(1);
+    }
+
+    mosaic *m = (mosaic *)calloc(1, sizeof(mosaic));
+    if (!m)
+    {
+        fprintf(stderr, "Unable to allocate memory\n");
+        exit(1);
+    }
+
+    if (fscanf(fp, "%d %d", &m->cols, &m->rows) != 2 || m->cols <= 0 || m->rows <= 0)
+    {
+        fprintf(stderr, "Invalid mosaic size (error loading '%s')\n", manifest);
+        exit(1);
+    }
+
+    int count = m->cols * m->rows;
+    m->files = (char **)malloc(count * sizeof(char *));
+    m->tiles = (FILE **)calloc(m->cols, sizeof(FILE *));
+    m->open_row = -1;
+    m->data_offset = (long *)malloc(count * sizeof(long));
+    m->col_x = (int *)calloc(m->cols + 1, sizeof(int));
+    m->row_y = (int *)calloc(m->rows + 1, sizeof(int));
+    if (!m->files || !m->tiles || !m->data_offset || !m->col_x || !m->row_y)
+    {
+        fprintf(stderr, "Unable to allocate memory\n");
+        exit(1);
+    }
+
+    for (int t = 0; t < count; t++)
+    {
+        int r = t / m->cols;
+        int c = t % m->cols;
+        int w, h;
+
+        if (fscanf(fp, "%4095s", name) != 1)
+        {
+            fprintf(stderr, "Missing tile %d (error loading '%s')\n", t, manifest);
+            exit(1);
+        }
+
+        m->files[t] = tile_path(manifest, name);
+
+        FILE *tile = open_ppm(m->files[t], &w, &h);
+        m->data_offset[t] = ftell(tile);
+        fclose(tile);
+
+        // the offsets are stored one position ahead and turned into prefix sums below
+        if (r == 0)
+        {
+            m->col_x[c + 1] = w;
+        }
+        if (c == 0)
+        {
+            m->row_y[r + 1] = h;
+        }
+
+        if (m->col_x[c + 1] != w || m->row_y[r + 1] != h)
+        {
+            fprintf(stderr, "Tile '%s' does not line up with its row / column\n", m->files[t]);
+            exit(1);
+        }
+    }
+    fclose(fp);
+
+    int max_h = 0;
+    for (int c = 0; c < m->cols; c++)
+    {
+        m->col_x[c + 1] += m->col_x[c];
+    }
+    for (int r = 0; r < m->rows; r++)
+    {
+        if (m->row_y[r + 1] > max_h)
+        {
+            max_h = m->row_y[r + 1];
+        }
+        m->row_y[r + 1] += m->row_y[r];
+    }
+
+    m->x = m->col_x[m->cols];
+    m->y = m->row_y[m->rows];
+
+    // one tile row plus the halo on both sides is the most the band ever holds
+    m->capacity = max_h + 2 * MOSAIC_HALO;
+    if (m->capacity > m->y)
+    {
+        m->capacity = m->y;
+    }
+
+    m->band.x = m->x;
+    m->band.y = 0;
+    m->band.data = (ppm_pixel *)malloc((size_t)m->x * m->capacity * sizeof(ppm_pixel));
+    if (!m->band.data)
+    {
+        fprintf(stderr, "Unable to allocate memory\n");
+        exit(1);
+    }
+
+    return m;
+}
+
+static void close_tile_row(mosaic *m)
+{
+    for (int c = 0; c < m->cols && m->open_row >= 0; c++)
+    {
+        fclose(m->tiles[c]);
+    }
+    m->open_row = -1;
+}
+
+// Makes the tiles of row `r` the open ones. Bands only move down, so every row is opened once.
+static void open_tile_row(mosaic *m, int r)
+{
+    if (m->open_row == r)
+    {
+        return;
+    }
+
+    close_tile_row(m);
+    for (int c = 0; c < m->cols; c++)
+    {
+        m->tiles[c] = fopen(m->files[r * m->cols + c], "rb");
+        if (!m->tiles[c])
+        {
+            fprintf(stderr, "Error loading tile '%s'\n", m->files[r * m->cols + c]);
+            exit(1);
+        }
+    }
+    m->open_row = r;
+}
+
+// Reads the virtual rows [y0, y1) straight from the tiles into `dst` (m->x pixels per row).
+void mosaic_read_rows(mosaic *m, int y0, int y1, ppm_pixel *dst)
+{
+    for (int r = 0; r < m->rows && y0 < y1; r++)
+    {
+        int lo = y0 > m->row_y[r] ? y0 : m->row_y[r];
+        int hi = y1 < m->row_y[r + 1] ? y1 : m->row_y[r + 1];
+
+        if (lo >= hi)
+        {
+            continue;
+        }
+
+        open_tile_row(m, r);
+        for (int c = 0; c < m->cols; c++)
+        {
+            int t = r * m->cols + c;
+            int w = m->col_x[c + 1] - m->col_x[c];
+
+            FILE *fp = m->tiles[c];
+            if (fseek(fp, m->data_offset[t] + (long)(lo - m->row_y[r]) * w * 3, SEEK_SET))
+            {
+                fprintf(stderr, "Error loading tile '%s'\n", m->files[t]);
+                exit(1);
+            }
+
+            for (int y = lo; y < hi; y++)
+            {
+                ppm_pixel *row = dst + (size_t)(y - y0) * m->x + m->col_x[c];
+                if ((int)fread(row, 3, w, fp) != w)
+                {
+                    fprintf(stderr, "Error loading tile '%s'\n", m->files[t]);
+                    exit(1);
+                }
+            }
+        }
+    }
+}
+
+// Slides the band so that it holds the rows [y0, y1). Bands only ever move down, so rows that
+// are already in memory (the halo of the previous band) are kept and never read twice.
+void mosaic_load_rows(mosaic *m, int y0, int y1)
+{
+    int old_end = m->row0 + m->band.y;
+    int kept = 0;
+
+    if (y1 - y0 > m->capacity)
+    {
+        fprintf(stderr, "Mosaic band of %d rows exceeds its capacity\n", y1 - y0);
+        exit(1);
+    }
+
+    if (m->band.y > 0 && y0 >= m->row0 && y0 < old_end)
+    {
+        kept = (old_end < y1 ? old_end : y1) - y0;
+        memmove(m->band.data, m->band.data + (size_t)(y0 - m->row0) * m->x,
+                (size_t)kept * m->x * sizeof(ppm_pixel));
+    }
+
+    mosaic_read_rows(m, y0 + kept, y1, m->band.data + (size_t)kept * m->x);
+
+    m->row0 = y0;
+    m->band.y = y1 - y0;
+}
+
+// Reads the whole mosaic into one image, for mosaics small enough not to need rescaling.
+ppm_image *mosaic_to_image(mosaic *m)
+{
+    ppm_image *img = (ppm_image *)malloc(sizeof(ppm_image));
+    if (!img)
+    {
+        fprintf(stderr, "Unable to allocate memory\n");
+        exit(1);
+    }
+
+    img->x = m->x;
+    img->y = m->y;
+    img->data = (ppm_pixel *)malloc((size_t)m->x * m->y * sizeof(ppm_pixel));
+    if (!img->data)
+    {
+        fprintf(stderr, "Unable to allocate memory\n");
+        exit(1);
+    }
+
+    mosaic_read_rows(m, 0, m->y, img->data);
+    return img;
+}
+
+void free_mosaic(mosaic *m)
+{
+    close_tile_row(m);
+    for (int t = 0; t < m->cols * m->rows; t++)
+    {
+        free(m->files[t]);
+    }
+    free(m->files);
+    free(m->tiles);
+    free(m->data_offset);
+    free(m->col_x);
+    free(m->row_y);
+    free(m->band.data);
+    free(m);
+}
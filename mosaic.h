@@ -0,0 +1,36 @@
+#ifndef MOSAIC_H
+#define MOSAIC_H
+
+#include "helpers.h"
+#include <stdio.h>
+
+// Rows kept above and below a tile row so the 4-tap bicubic window never leaves the band.
+#define MOSAIC_HALO 2
+
+// A grid of adjacent PPM tiles seen as one virtual image. Only a band of rows is kept in
+// memory at a time; tiles are read in raster order as the band slides down. The tiles of the
+// row being read stay open (`tiles`, one per column) until the band moves past that row, so a
+// band costs one seek per tile and the number of open files does not grow with the grid.
+typedef struct mosaic
+{
+    int cols, rows;
+    int x, y;
+    char **files;
+    FILE **tiles;
+    int open_row;
+    long *data_offset;
+    int *col_x;
+    int *row_y;
+
+    ppm_image band;
+    int row0;
+    int capacity;
+} mosaic;
+
+mosaic *read_mosaic(const char *manifest);
+void mosaic_read_rows(mosaic *m, int y0, int y1, ppm_pixel *dst);
+void mosaic_load_rows(mosaic *m, int y0, int y1);
+ppm_image *mosaic_to_image(mosaic *m);
+void free_mosaic(mosaic *m);
+
+#endif
@@ -0,0 +1,520 @@
+#include "polygon.h"
+#include "vector.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define CLAMP(v, min, max) if(v < min) { v = min; } else if(v > max) { v = max; }
+
+// The padded grid has (rows + 1) x (cols + 1) points; point (I, J) is grid[I - 1][J - 1] and
+// the points outside the grid are 0. Its edges are numbered horizontal ones first:
+//     h(I, J), between points (I, J) and (I, J + 1): I * cols + J
+//     v(I, J), between points (I, J) and (I + 1, J): (rows + 1) * cols + I * (cols + 1) + J
+// A half-edge is 2 * edge + side, where side 0 is the cell above / to the left of the edge and
+// side 1 the cell below / to the right. Each cell has at most one segment per edge, so every
+// half-edge belongs to at most one segment and the threads never write the same one.
+
+static void *polygon_alloc(size_t size)
+{
+    void *ptr = malloc(size ? size : 1);
+    if (!ptr)
+    {
+        fprintf(stderr, "Unable to allocate memory\n");
+        exit(1);
+    }
+    return ptr;
+}
+
+static void *polygon_grow(void *ptr, int *capacity, int needed, size_t size)
+{
+    if (needed <= *capacity)
+    {
+        return ptr;
+    }
+
+    *capacity = needed > 2 * *capacity ? needed : 2 * *capacity;
+    ptr = realloc(ptr, *capacity * size);
+    if (!ptr)
+    {
+        fprintf(stderr, "Unable to allocate memory\n");
+        exit(1);
+    }
+    return ptr;
+}
+
+static inline int horizontal_edges(polygon_set *ps)
+{
+    return (ps->rows + 1) * ps->cols;
+}
+
+static inline unsigned char padded_point(polygon_set *ps, unsigned char **grid, int I, int J)
+{
+    if (I < 1 || I > ps->p + 1 || J < 1 || J > ps->q + 1)
+    {
+        return 0;
+    }
+    return grid[I - 1][J - 1];
+}
+
+static inline unsigned char padded_config(polygon_set *ps, unsigned char **grid, int I, int J)
+{
+    return 8 * padded_point(ps, grid, I, J) + 4 * padded_point(ps, grid, I, J + 1) +
+           2 * padded_point(ps, grid, I + 1, J + 1) + 1 * padded_point(ps, grid, I + 1, J);
+}
+
+// Half-edge through which a segment of cell (I, J) leaves it on side `edge`.
+static inline int32_t cell_half_edge(polygon_set *ps, int I, int J, int edge)
+{
+    switch (edge)
+    {
+    case EDGE_TOP:
+        return 2 * (I * ps->cols + J) + 1;
+    case EDGE_BOTTOM:
+        return 2 * ((I + 1) * ps->cols + J);
+    case EDGE_LEFT:
+        return 2 * (horizontal_edges(ps) + I * (ps->cols + 1) + J) + 1;
+    default:
+        return 2 * (horizontal_edges(ps) + I * (ps->cols + 1) + J + 1);
+    }
+}
+
+// Row of the cell a half-edge belongs to.
+static inline int half_edge_row(polygon_set *ps, int32_t h)
+{
+    int e = h >> 1;
+
+    if (e < horizontal_edges(ps))
+    {
+        return e / ps->cols - 1 + (h & 1);
+    }
+    return (e - horizontal_edges(ps)) / (ps->cols + 1);
+}
+
+// Midpoint of an edge, in half cells: (row, column).
+static inline void edge_point(polygon_set *ps, int e, int32_t point[2])
+{
+    if (e < horizontal_edges(ps))
+    {
+        point[0] = 2 * (e / ps->cols);
+        point[1] = 2 * (e % ps->cols) + 1;
+    }
+    else
+    {
+        e -= horizontal_edges(ps);
+        point[0] = 2 * (e / (ps->cols + 1)) + 1;
+        point[1] = 2 * (e % (ps->cols + 1));
+    }
+}
+
+polygon_set *create_polygon_set(int p, int q, int N)
+{
+    polygon_set *ps = (polygon_set *)calloc(1, sizeof(polygon_set));
+    if (!ps)
+    {
+        fprintf(stderr, "Unable to allocate memory\n");
+        exit(1);
+    }
+
+    ps->p = p;
+    ps->q = q;
+    ps->rows = p + 2;
+    ps->cols = q + 2;
+    ps->edges = (ps->rows + 1) * ps->cols + ps->rows * (ps->cols + 1);
+    ps->next = (int32_t *)polygon_alloc(2 * (size_t)ps->edges * sizeof(int32_t));
+    ps->chain_of = (int32_t *)polygon_alloc(2 * (size_t)ps->edges * sizeof(int32_t));
+    memset(ps->next, 0xff, 2 * (size_t)ps->edges * sizeof(int32_t));
+    memset(ps->chain_of, 0xff, 2 * (size_t)ps->edges * sizeof(int32_t));
+
+    ps->N = N;
+    ps->band_rows = (int *)polygon_alloc((N + 1) * sizeof(int));
+    ps->bands = (polygon_band *)calloc(N, sizeof(polygon_band));
+    ps->chain_base = (int *)polygon_alloc((N + 1) * sizeof(int));
+    if (!ps->bands)
+    {
+        fprintf(stderr, "Unable to allocate memory\n");
+        exit(1);
+    }
+
+    for (int b = 0; b <= N; b++)
+    {
+        ps->band_rows[b] = b * ps->rows / N;
+    }
+
+    return ps;
+}
+
+// First pass: links the two half-edges of every segment in the cell rows of this thread.
+void link_cells(polygon_set *ps, unsigned char **grid, int thread_id, int N)
+{
+    (void)N;
+
+    for (int I = ps->band_rows[thread_id]; I < ps->band_rows[thread_id + 1]; I++)
+    {
+        for (int J = 0; J < ps->cols; J++)
+        {
+            unsigned char k = padded_config(ps, grid, I, J);
+
+            for (int e = 0; e < 4 && case_edges[k][e] >= 0; e += 2)
+            {
+                int32_t a = cell_half_edge(ps, I, J, case_edges[k][e]);
+                int32_t b = cell_half_edge(ps, I, J, case_edges[k][e + 1]);
+                ps->next[a] = b;
+                ps->next[b] = a;
+            }
+        }
+    }
+}
+
+static void band_point(polygon_band *band, polygon_set *ps, int32_t h)
+{
+    band->points = (int32_t *)polygon_grow(band->points, &band->point_capacity, 2 * (band->point_count + 1),
+                                           sizeof(int32_t));
+    edge_point(ps, h >> 1, &band->points[2 * band->point_count]);
+    band->point_count++;
+}
+
+// Follows the segments from half-edge `h` until the chain either closes or leaves the band.
+static void trace_chain(polygon_set *ps, polygon_band *band, int32_t h, int r0, int r1)
+{
+    int id = band->chain_count;
+    chain c = {band->point_count, 0, 0, h, -1};
+
+    band_point(band, ps, h);
+    for (int32_t cur = h;;)
+    {
+        int32_t g = ps->next[cur];
+        ps->chain_of[cur] = ps->chain_of[g] = id;
+
+        if ((g >> 1) == (h >> 1))
+        {
+            c.closed = 1;
+            break;
+        }
+        band_point(band, ps, g);
+
+        // the segment on the other side of the edge belongs to the next band
+        int row = half_edge_row(ps, g ^ 1);
+        if (row < r0 || row >= r1)
+        {
+            c.end = g;
+            break;
+        }
+        cur = g ^ 1;
+    }
+
+    c.count = band->point_count - c.first;
+    band->chains = (chain *)polygon_grow(band->chains, &band->chain_capacity, id + 1, sizeof(chain));
+    band->chains[id] = c;
+    band->chain_count++;
+}
+
+// Second pass: assembles the segments of this thread's band into chains. Chains that enter the
+// band through its top or bottom seam are traced first, then everything left is a whole ring.
+void trace_band(polygon_set *ps, int thread_id)
+{
+    polygon_band *band = &ps->bands[thread_id];
+    int r0 = ps->band_rows[thread_id];
+    int r1 = ps->band_rows[thread_id + 1];
+
+    for (int J = 0; J < ps->cols; J++)
+    {
+        int32_t top = 2 * (r0 * ps->cols + J) + 1;
+        int32_t bottom = 2 * (r1 * ps->cols + J);
+
+        if (r0 > 0 && r1 > r0 && ps->next[top] >= 0 && ps->chain_of[top] < 0)
+        {
+            trace_chain(ps, band, top, r0, r1);
+        }
+        if (r1 < ps->rows && r1 > r0 && ps->next[bottom] >= 0 && ps->chain_of[bottom] < 0)
+        {
+            trace_chain(ps, band, bottom, r0, r1);
+        }
+    }
+
+    for (int I = r0; I < r1; I++)
+    {
+        for (int J = 0; J < ps->cols; J++)
+        {
+            for (int edge = EDGE_TOP; edge <= EDGE_LEFT; edge++)
+            {
+                int32_t h = cell_half_edge(ps, I, J, edge);
+                if (ps->next[h] >= 0 && ps->chain_of[h] < 0)
+                {
+                    trace_chain(ps, band, h, r0, r1);
+                }
+            }
+        }
+    }
+}
+
+static ring *new_ring(polygon_set *ps, int *capacity)
+{
+    ps->rings = (ring *)polygon_grow(ps->rings, capacity, ps->ring_count + 1, sizeof(ring));
+    ring *r = &ps->rings[ps->ring_count++];
+    memset(r, 0, sizeof(ring));
+    r->parent = -1;
+    return r;
+}
+
+static void append_chain(ring *r, int *capacity, polygon_band *band, chain *c, int forward)
+{
+    // consecutive chains share the point on their seam
+    int skip = r->count > 0;
+
+    r->points = (int32_t *)polygon_grow(r->points, capacity, 2 * (r->count + c->count), sizeof(int32_t));
+    for (int k = skip; k < c->count; k++)
+    {
+        int src = c->first + (forward ? k : c->count - 1 - k);
+        r->points[2 * r->count] = band->points[2 * src];
+        r->points[2 * r->count + 1] = band->points[2 * src + 1];
+        r->count++;
+    }
+}
+
+// Third pass, on a single thread: every chain that ends on a seam continues in the chain that
+// starts from the other side of the same edge. The open chains are few (at most two per edge on
+// a seam), so this is cheap next to the two parallel passes.
+void merge_seams(polygon_set *ps)
+{
+    int ring_capacity = 0;
+    int chains = 0;
+
+    for (int b = 0; b < ps->N; b++)
+    {
+        ps->chain_base[b] = chains;
+        chains += ps->bands[b].chain_count;
+    }
+    ps->chain_base[ps->N] = chains;
+
+    ps->chain_ring = (int *)polygon_alloc(chains * sizeof(int));
+    int *band_of = (int *)polygon_alloc(chains * sizeof(int));
+    int32_t *end_of = (int32_t *)polygon_alloc(2 * (size_t)ps->edges * sizeof(int32_t));
+
+    for (int b = 0; b < ps->N; b++)
+    {
+        for (int c = 0; c < ps->bands[b].chain_count; c++)
+        {
+            int id = ps->chain_base[b] + c;
+            chain *ch = &ps->bands[b].chains[c];
+
+            band_of[id] = b;
+            ps->chain_ring[id] = -1;
+            if (ch->closed)
+            {
+                int capacity = 0;
+                ps->chain_ring[id] = ps->ring_count;
+                append_chain(new_ring(ps, &ring_capacity), &capacity, &ps->bands[b], ch, 1);
+            }
+            else
+            {
+                end_of[ch->start] = 2 * id;
+                end_of[ch->end] = 2 * id + 1;
+            }
+        }
+    }
+
+    for (int id = 0; id < chains; id++)
+    {
+        if (ps->chain_ring[id] >= 0)
+        {
+            continue;
+        }
+
+        int capacity = 0;
+        int ring_id = ps->ring_count;
+        ring *r = new_ring(ps, &ring_capacity);
+        int cur = id, forward = 1;
+
+        for (;;)
+        {
+            polygon_band *band = &ps->bands[band_of[cur]];
+            chain *ch = &band->chains[cur - ps->chain_base[band_of[cur]]];
+
+            ps->chain_ring[cur] = ring_id;
+            append_chain(r, &capacity, band, ch, forward);
+
+            int32_t next = end_of[(forward ? ch->end : ch->start) ^ 1];
+            cur = next >> 1;
+            forward = !(next & 1);
+            if (cur == id)
+            {
+                // the last point is the seam point the ring started from
+                r->count--;
+                break;
+            }
+        }
+    }
+
+    for (int k = 0; k < ps->ring_count; k++)
+    {
+        ring *r = &ps->rings[k];
+        int top = r->points[0];
+
+        for (int i = 1; i < r->count; i++)
+        {
+            if (r->points[2 * i] < top)
+            {
+                top = r->points[2 * i];
+            }
+        }
+        // first row whose scanline, a quarter cell below the top of the row, is under the top point
+        r->top = (top + 1) / 2;
+    }
+
+    free(band_of);
+    free(end_of);
+}
+
+// Fourth pass: nesting. Every thread scans its cell rows along the line a quarter of a cell
+// below the top of the row, which never passes through a point. Rings do not cross, so their
+// crossings with the line nest like parentheses: a crossing of the ring on top of the stack
+// leaves it, any other one enters a ring whose parent is the ring on top of the stack. Only the
+// row a ring starts on sets its parent, so the threads write disjoint rings.
+void nest_rings(polygon_set *ps, unsigned char **grid, int thread_id, int N)
+{
+    (void)N;
+    int *stack = (int *)polygon_alloc((ps->ring_count + 1) * sizeof(int));
+
+    for (int I = ps->band_rows[thread_id]; I < ps->band_rows[thread_id + 1]; I++)
+    {
+        int band = thread_id;
+        int depth = 0;
+        // the line, in quarter cells
+        int line = 4 * I + 1;
+
+        for (int J = 0; J < ps->cols; J++)
+        {
+            unsigned char k = padded_config(ps, grid, I, J);
+            double x[2];
+            int id[2];
+            int crossings = 0;
+
+            for (int e = 0; e < 4 && case_edges[k][e] >= 0; e += 2)
+            {
+                int32_t a = cell_half_edge(ps, I, J, case_edges[k][e]);
+                int32_t b = cell_half_edge(ps, I, J, case_edges[k][e + 1]);
+                int32_t pa[2], pb[2];
+
+                edge_point(ps, a >> 1, pa);
+                edge_point(ps, b >> 1, pb);
+                if ((2 * pa[0] < line) == (2 * pb[0] < line))
+                {
+                    continue;
+                }
+
+                x[crossings] = pa[1] + (double)(pb[1] - pa[1]) * (line - 2 * pa[0]) / (2 * (pb[0] - pa[0]));
+                id[crossings] = ps->chain_ring[ps->chain_base[band] + ps->chain_of[a]];
+                crossings++;
+            }
+
+            if (crossings == 2 && x[1] < x[0])
+            {
+                int t = id[0];
+                id[0] = id[1];
+                id[1] = t;
+            }
+
+            for (int c = 0; c < crossings; c++)
+            {
+                if (depth > 0 && stack[depth - 1] == id[c])
+                {
+                    depth--;
+                    continue;
+                }
+
+                if (ps->rings[id[c]].top == I)
+                {
+                    ps->rings[id[c]].parent = depth > 0 ? stack[depth - 1] : -1;
+                }
+                stack[depth++] = id[c];
+            }
+        }
+    }
+
+    free(stack);
+}
+
+// Twice the signed area of a ring, with x the column and y the row.
+static long long ring_area2(ring *r)
+{
+    long long area = 0;
+
+    for (int i = 0; i < r->count; i++)
+    {
+        int j = (i + 1) % r->count;
+        area += (long long)r->points[2 * i + 1] * r->points[2 * j] - (long long)r->points[2 * j + 1] * r->points[2 * i];
+    }
+
+    return area;
+}
+
+// Writes one line per ring, "parent depth n x0 y0 ... x(n-1) y(n-1)", in pixels of the contour
+// image. The line number of a ring is its id and rings at an odd depth are holes. Outer rings
+// are written counterclockwise and holes clockwise, as seen on the image; the points that
+// follow the padding are clamped to the border of the image.
+void write_polygons(polygon_set *ps, const char *filename)
+{
+    int *depth = (int *)polygon_alloc(ps->ring_count * sizeof(int));
+
+    FILE *fp = fopen(filename, "w");
+    if (!fp)
+    {
+        fprintf(stderr, "Unable to open file '%s'\n", filename);
+        exit(1);
+    }
+
+    // a parent always starts above its children, so walking up the tree terminates
+    for (int k = 0; k < ps->ring_count; k++)
+    {
+        depth[k] = 0;
+        for (int a = ps->rings[k].parent; a >= 0; a = ps->rings[a].parent)
+        {
+            depth[k]++;
+        }
+    }
+
+    for (int k = 0; k < ps->ring_count; k++)
+    {
+        ring *r = &ps->rings[k];
+        // rows grow downwards, so a counterclockwise ring has a negative area here
+        int reverse = (ring_area2(r) < 0) == (depth[k] % 2);
+
+        fprintf(fp, "%d %d %d", r->parent, depth[k], r->count);
+        for (int i = 0; i < r->count; i++)
+        {
+            int32_t *point = &r->points[2 * (reverse ? r->count - 1 - i : i)];
+            int x = (point[1] - 2) * STEP / 2;
+            int y = (point[0] - 2) * STEP / 2;
+
+            CLAMP(x, 0, ps->q * STEP);
+            CLAMP(y, 0, ps->p * STEP);
+            fprintf(fp, " %d %d", x, y);
+        }
+        fputc('\n', fp);
+    }
+
+    fclose(fp);
+    free(depth);
+}
+
+void free_polygon_set(polygon_set *ps)
+{
+    for (int b = 0; b < ps->N; b++)
+    {
+        free(ps->bands[b].points);
+        free(ps->bands[b].chains);
+    }
+    for (int k = 0; k < ps->ring_count; k++)
+    {
+        free(ps->rings[k].points);
+    }
+
+    free(ps->next);
+    free(ps->chain_of);
+    free(ps->band_rows);
+    free(ps->bands);
+    free(ps->chain_base);
+    free(ps->chain_ring);
+    free(ps->rings);
+    free(ps);
+}
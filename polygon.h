@@ -0,0 +1,61 @@
+#ifndef POLYGON_H
+#define POLYGON_H
+
+#include "helpers.h"
+
+// A closed contour. Points are edge midpoints of the padded grid (see polygon.c), stored as
+// (row, column) pairs in half cells.
+typedef struct ring
+{
+    int32_t *points;
+    int count;
+    int top;            // first row of cells whose scanline crosses the ring
+    int parent;         // innermost ring that contains this one, -1 if none does
+} ring;
+
+// A run of segments that stays inside one band of cell rows. It is either a whole ring or
+// starts and ends on the edges shared with the bands above and below.
+typedef struct chain
+{
+    int first, count;   // in the points of the band
+    int closed;
+    int32_t start, end; // half-edges on the seams, for open chains
+} chain;
+
+typedef struct polygon_band
+{
+    int32_t *points;
+    int point_count, point_capacity;
+    chain *chains;
+    int chain_count, chain_capacity;
+} polygon_band;
+
+// Rings of the contour and their containment tree. The grid is padded with a ring of 0 points,
+// so that contours touching the border of the image are closed along it.
+typedef struct polygon_set
+{
+    int p, q;
+    int rows, cols;     // cells of the padded grid
+    int edges;
+    int32_t *next;      // per half-edge: the other half-edge of its segment, or -1
+    int32_t *chain_of;  // per half-edge: the chain of its segment, within its band
+
+    int N;
+    int *band_rows;     // band b holds the cell rows [band_rows[b], band_rows[b + 1])
+    polygon_band *bands;
+    int *chain_base;    // id of the first chain of every band
+    int *chain_ring;
+
+    ring *rings;
+    int ring_count;
+} polygon_set;
+
+polygon_set *create_polygon_set(int p, int q, int N);
+void link_cells(polygon_set *ps, unsigned char **grid, int thread_id, int N);
+void trace_band(polygon_set *ps, int thread_id);
+void merge_seams(polygon_set *ps);
+void nest_rings(polygon_set *ps, unsigned char **grid, int thread_id, int N);
+void write_polygons(polygon_set *ps, const char *filename);
+void free_polygon_set(polygon_set *ps);
+
+#endif
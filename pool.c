@@ -0,0 +1,191 @@
+#include "pool.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+typedef struct pool_worker
+{
+    worker_pool *pool;
+    int index;
+} pool_worker;
+
+typedef struct pool_waiter
+{
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    int done;
+} pool_waiter;
+
+static pool_job *find_job(worker_pool *pool, uint64_t seq)
+{
+    for (pool_job *job = pool->head; job; job = job->next)
+    {
+        if (job->seq == seq)
+        {
+            return job;
+        }
+    }
+    return NULL;
+}
+
+static void *pool_thread(void *arg)
+{
+    pool_worker *worker = (pool_worker *)arg;
+    worker_pool *pool = worker->pool;
+    uint64_t seq = 0;
+
+    pthread_mutex_lock(&pool->lock);
+    for (;;)
+    {
+        pool_job *job;
+        while (!(job = find_job(pool, seq)) && !pool->stop)
+        {
+            pthread_cond_wait(&pool->submitted, &pool->lock);
+        }
+        if (!job)
+        {
+            break;
+        }
+        pthread_mutex_unlock(&pool->lock);
+
+        job->fn(job->args + worker->index * job->arg_size);
+
+        pthread_mutex_lock(&pool->lock);
+        seq++;
+        if (--job->remaining == 0)
+        {
+            // every worker runs the jobs in order, so the last one to finish a job finds it at
+            // the head of the queue
+            pool->head = job->next;
+            if (!pool->head)
+            {
+                pool->tail = NULL;
+            }
+            pthread_mutex_unlock(&pool->lock);
+
+            if (job->done)
+            {
+                job->done(job->data);
+            }
+            free(job);
+
+            pthread_mutex_lock(&pool->lock);
+        }
+    }
+    pthread_mutex_unlock(&pool->lock);
+
+    return NULL;
+}
+
+worker_pool *pool_create(int N)
+{
+    worker_pool *pool = (worker_pool *)calloc(1, sizeof(worker_pool));
+    pool_worker *workers = (pool_worker *)malloc(N * sizeof(pool_worker));
+    if (!pool || !workers)
+    {
+        fprintf(stderr, "Unable to allocate memory\n");
+        exit(1);
+    }
+
+    pool->N = N;
+    pool->threads = (pthread_t *)malloc(N * sizeof(pthread_t));
+    if (!pool->threads)
+    {
+        fprintf(stderr, "Unable to allocate memory\n");
+        exit(1);
+    }
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->submitted, NULL);
+
+    // the workers only need their slot until they read it, but it lives as long as the pool
+    pool->workers = workers;
+    for (int i = 0; i < N; i++)
+    {
+        workers[i].pool = pool;
+        workers[i].index = i;
+        pthread_create(&pool->threads[i], NULL, pool_thread, &workers[i]);
+    }
+
+    return pool;
+}
+
+// Queues a job and returns at once. `args` must stay valid until `done(data)` is called, which
+// happens on the worker that finishes the job last. Safe to call from any thread.
+void pool_submit(worker_pool *pool, pool_fn fn, void *args, size_t arg_size, pool_done done, void *data)
+{
+    pool_job *job = (pool_job *)malloc(sizeof(pool_job));
+    if (!job)
+    {
+        fprintf(stderr, "Unable to allocate memory\n");
+        exit(1);
+    }
+
+    job->fn = fn;
+    job->args = (char *)args;
+    job->arg_size = arg_size;
+    job->remaining = pool->N;
+    job->done = done;
+    job->data = data;
+    job->next = NULL;
+
+    pthread_mutex_lock(&pool->lock);
+    job->seq = pool->next_seq++;
+    if (pool->tail)
+    {
+        pool->tail->next = job;
+    }
+    else
+    {
+        pool->head = job;
+    }
+    pool->tail = job;
+    pthread_cond_broadcast(&pool->submitted);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+static void wake_waiter(void *data)
+{
+    pool_waiter *waiter = (pool_waiter *)data;
+
+    pthread_mutex_lock(&waiter->lock);
+    waiter->done = 1;
+    pthread_cond_signal(&waiter->cond);
+    pthread_mutex_unlock(&waiter->lock);
+}
+
+// Runs a job and waits for it to finish.
+void pool_run(worker_pool *pool, pool_fn fn, void *args, size_t arg_size)
+{
+    pool_waiter waiter = {PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, 0};
+
+    pool_submit(pool, fn, args, arg_size, wake_waiter, &waiter);
+
+    pthread_mutex_lock(&waiter.lock);
+    while (!waiter.done)
+    {
+        pthread_cond_wait(&waiter.cond, &waiter.lock);
+    }
+    pthread_mutex_unlock(&waiter.lock);
+
+    pthread_mutex_destroy(&waiter.lock);
+    pthread_cond_destroy(&waiter.cond);
+}
+
+// Lets the workers finish the queued jobs, then stops them.
+void pool_destroy(worker_pool *pool)
+{
+    pthread_mutex_lock(&pool->lock);
+    pool->stop = 1;
+    pthread_cond_broadcast(&pool->submitted);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (int i = 0; i < pool->N; i++)
+    {
+        pthread_join(pool->threads[i], NULL);
+    }
+
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->submitted);
+    free(pool->threads);
+    free(pool->workers);
+    free(pool);
+}
@@ -0,0 +1,45 @@
+#ifndef POOL_H
+#define POOL_H
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+
+typedef void *(*pool_fn)(void *arg);
+typedef void (*pool_done)(void *data);
+
+// A job runs `fn` once on every worker of the pool, worker i getting the i-th of the N
+// consecutive `arg_size` byte arguments, so it is a whole parallel pipeline (with its own
+// barrier) and not a single task.
+typedef struct pool_job
+{
+    uint64_t seq;
+    pool_fn fn;
+    char *args;
+    size_t arg_size;
+    int remaining;
+    pool_done done;
+    void *data;
+    struct pool_job *next;
+} pool_job;
+
+// N persistent workers that run the submitted jobs in order. A worker moves on to the next job
+// as soon as it finished its own share of the current one, so consecutive jobs overlap.
+typedef struct worker_pool
+{
+    int N;
+    pthread_t *threads;
+    struct pool_worker *workers;
+    pthread_mutex_t lock;
+    pthread_cond_t submitted;
+    pool_job *head, *tail;
+    uint64_t next_seq;
+    int stop;
+} worker_pool;
+
+worker_pool *pool_create(int N);
+void pool_submit(worker_pool *pool, pool_fn fn, void *args, size_t arg_size, pool_done done, void *data);
+void pool_run(worker_pool *pool, pool_fn fn, void *args, size_t arg_size);
+void pool_destroy(worker_pool *pool);
+
+#endif
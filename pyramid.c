@@ -0,0 +1,100 @@
+#include "pyramid.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Number of levels (the base included) that can be built from `base`, at most `requested`.
+// A level needs at least two grid cells on each side to produce any contour.
+int pyramid_level_count(ppm_image *base, int requested)
+{
+    int count = 1;
+    int x = base->x;
+    int y = base->y;
+
+    if (requested > PYRAMID_MAX_LEVELS)
+    {
+        requested = PYRAMID_MAX_LEVELS;
+    }
+
+    while (count < requested && x / 2 >= 2 * STEP && y / 2 >= 2 * STEP)
+    {
+        x /= 2;
+        y /= 2;
+        count++;
+    }
+
+    return count;
+}
+
+// Builds the rows of `dst` that belong to this thread as 2x2 box averages of `src`.
+// It has to run before `src` is overwritten by march().
+void downsample_level(ppm_image *src, ppm_image *dst, int thread_id, int N)
+{
+    int start = thread_id * dst->x / N;
+    int end = (thread_id + 1) * dst->x / N;
+
+    for (int i = start; i < end; i++)
+    {
+        ppm_pixel *row0 = src->data + (size_t)(2 * i) * src->y;
+        ppm_pixel *row1 = row0 + src->y;
+
+        for (int j = 0; j < dst->y; j++)
+        {
+            ppm_pixel *a = &row0[2 * j];
+            ppm_pixel *b = &row1[2 * j];
+            ppm_pixel *out = &dst->data[(size_t)i * dst->y + j];
+
+            out->red = (a[0].red + a[1].red + b[0].red + b[1].red + 2) / 4;
+            out->green = (a[0].green + a[1].green + b[0].green + b[1].green + 2) / 4;
+            out->blue = (a[0].blue + a[1].blue + b[0].blue + b[1].blue + 2) / 4;
+        }
+    }
+}
+
+// Writes `img` as PYRAMID_TILE x PYRAMID_TILE tiles named <prefix>_<level>_<row>_<col>.ppm,
+// the layout web viewers expect for one zoom level. Border tiles may be smaller.
+void write_tile_set(ppm_image *img, const char *prefix, int level)
+{
+    size_t len = strlen(prefix) + 64;
+    char *filename = (char *)malloc(len);
+    if (!filename)
+    {
+        fprintf(stderr, "Unable to allocate memory\n");
+        exit(1);
+    }
+
+    for (int ti = 0; ti * PYRAMID_TILE < img->x; ti++)
+    {
+        for (int tj = 0; tj * PYRAMID_TILE < img->y; tj++)
+        {
+            int rows = img->x - ti * PYRAMID_TILE;
+            int cols = img->y - tj * PYRAMID_TILE;
+            if (rows > PYRAMID_TILE)
+            {
+                rows = PYRAMID_TILE;
+            }
+            if (cols > PYRAMID_TILE)
+            {
+                cols = PYRAMID_TILE;
+            }
+
+            snprintf(filename, len, "%s_%d_%d_%d.ppm", prefix, level, ti, tj);
+            FILE *fp = fopen(filename, "wb");
+            if (!fp)
+            {
+                fprintf(stderr, "Unable to open file '%s'\n", filename);
+                exit(1);
+            }
+
+            fprintf(fp, "P6\n%d %d\n%d\n", cols, rows, RGB_COMPONENT_COLOR);
+            for (int i = 0; i < rows; i++)
+            {
+                size_t offset = (size_t)(ti * PYRAMID_TILE + i) * img->y + tj * PYRAMID_TILE;
+                fwrite(img->data + offset, 3, cols, fp);
+            }
+            fclose(fp);
+        }
+    }
+
+    free(filename);
+}
@@ -0,0 +1,13 @@
+#ifndef PYRAMID_H
+#define PYRAMID_H
+
+#include "helpers.h"
+
+#define PYRAMID_TILE 256
+#define PYRAMID_MAX_LEVELS 16
+
+int pyramid_level_count(ppm_image *base, int requested);
+void downsample_level(ppm_image *src, ppm_image *dst, int thread_id, int N);
+void write_tile_set(ppm_image *img, const char *prefix, int level);
+
+#endif
@@ -0,0 +1,443 @@
+// Python bindings over the asynchronous API (async.h), built with `make python`:
+//
+//     import numpy as np, pytema1
+//     engine = pytema1.Engine(8)
+//     contour = np.asarray(engine.contour(image))
+//     contour, grid, segments = engine.contour(image, grid=True, vector=True)
+//
+// The input is any C-contiguous uint8 buffer of shape HxWx3, read in place, or HxW, which is
+// expanded to gray RGB since the pipeline samples RGB pixels. Results are returned as buffer
+// objects that NumPy wraps without copying.
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+#include "async.h"
+#include "contour.h"
+#include <unistd.h>
+
+enum
+{
+    BUFFER_IMAGE,       // a ppm_image of the pipeline
+    BUFFER_INPUT,       // the caller's buffer, contoured in place
+    BUFFER_GRID,        // a copy of the sample grid
+    BUFFER_SEGMENTS,    // the segments of a contour_index
+};
+
+typedef struct
+{
+    PyObject_HEAD
+    int kind;
+    void *data;
+    int ndim;
+    Py_ssize_t shape[3];
+    Py_ssize_t strides[3];
+    const char *format;
+    Py_ssize_t itemsize;
+    ppm_image *image;
+    contour_index *index;
+    Py_buffer input;
+} Buffer;
+
+typedef struct
+{
+    PyObject_HEAD
+    contour_engine *engine;
+} Engine;
+
+static int buffer_getbuffer(PyObject *self, Py_buffer *view, int flags)
+{
+    Buffer *buf = (Buffer *)self;
+    Py_ssize_t len = buf->itemsize;
+
+    for (int d = 0; d < buf->ndim; d++)
+    {
+        len *= buf->shape[d];
+    }
+
+    if (PyBuffer_FillInfo(view, self, buf->data, len, 0, flags))
+    {
+        return -1;
+    }
+    view->itemsize = buf->itemsize;
+    view->format = (flags & PyBUF_FORMAT) ? (char *)buf->format : NULL;
+    if (flags & PyBUF_ND)
+    {
+        view->ndim = buf->ndim;
+        view->shape = buf->shape;
+        view->strides = (flags & PyBUF_STRIDES) == PyBUF_STRIDES ? buf->strides : NULL;
+    }
+
+    return 0;
+}
+
+static void buffer_dealloc(PyObject *self)
+{
+    Buffer *buf = (Buffer *)self;
+
+    switch (buf->kind)
+    {
+    case BUFFER_IMAGE:
+        free(buf->image->data);
+        free(buf->image);
+        break;
+    case BUFFER_INPUT:
+        free(buf->image);
+        PyBuffer_Release(&buf->input);
+        break;
+    case BUFFER_GRID:
+        free(buf->data);
+        break;
+    case BUFFER_SEGMENTS:
+        free_contour_index(buf->index);
+        break;
+    }
+
+    Py_TYPE(self)->tp_free(self);
+}
+
+static PyBufferProcs buffer_as_buffer = {buffer_getbuffer, NULL};
+
+static PyTypeObject BufferType = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    .tp_name = "pytema1.Buffer",
+    .tp_doc = "Result of Engine.contour(), exposed through the buffer protocol.",
+    .tp_basicsize = sizeof(Buffer),
+    .tp_flags = Py_TPFLAGS_DEFAULT,
+    .tp_dealloc = buffer_dealloc,
+    .tp_as_buffer = &buffer_as_buffer,
+};
+
+// Row-major strides of a buffer of `ndim` dimensions.
+static Buffer *new_buffer(int kind, void *data, int ndim, const Py_ssize_t *shape, const char *format,
+                          Py_ssize_t itemsize)
+{
+    Buffer *buf = PyObject_New(Buffer, &BufferType);
+    if (!buf)
+    {
+        return NULL;
+    }
+
+    buf->kind = kind;
+    buf->data = data;
+    buf->ndim = ndim;
+    buf->format = format;
+    buf->itemsize = itemsize;
+    buf->image = NULL;
+    buf->index = NULL;
+
+    Py_ssize_t stride = itemsize;
+    for (int d = ndim - 1; d >= 0; d--)
+    {
+        buf->shape[d] = shape[d];
+        buf->strides[d] = stride;
+        stride *= shape[d];
+    }
+
+    return buf;
+}
+
+static Buffer *image_buffer(ppm_image *image, int kind)
+{
+    Py_ssize_t shape[3] = {image->y, image->x, 3};
+    Buffer *buf = new_buffer(kind, image->data, 3, shape, "B", 1);
+
+    if (buf)
+    {
+        buf->image = image;
+    }
+    return buf;
+}
+
+// The grid rows are separate allocations, so the grid is the one output that is copied.
+static Buffer *grid_buffer(unsigned char **grid, int rows, int columns)
+{
+    unsigned char *data = (unsigned char *)malloc((size_t)rows * columns);
+    if (!data)
+    {
+        free_grid(grid, rows - 1);
+        PyErr_NoMemory();
+        return NULL;
+    }
+
+    for (int i = 0; i < rows; i++)
+    {
+        memcpy(data + (size_t)i * columns, grid[i], columns);
+    }
+    free_grid(grid, rows - 1);
+
+    Py_ssize_t shape[2] = {rows, columns};
+    Buffer *buf = new_buffer(BUFFER_GRID, data, 2, shape, "B", 1);
+    if (!buf)
+    {
+        free(data);
+    }
+    return buf;
+}
+
+static Buffer *segments_buffer(contour_index *index)
+{
+    Py_ssize_t shape[2] = {index->count, 4};
+    Buffer *buf = new_buffer(BUFFER_SEGMENTS, index->segments, 2, shape, "i", sizeof(int32_t));
+
+    if (buf)
+    {
+        buf->index = index;
+    }
+    else
+    {
+        free_contour_index(index);
+    }
+    return buf;
+}
+
+static int engine_init(PyObject *self, PyObject *args, PyObject *kwds)
+{
+    static char *keywords[] = {"threads", "march_threads", NULL};
+    Engine *eng = (Engine *)self;
+    int threads, march_threads = 0;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "i|i", keywords, &threads, &march_threads))
+    {
+        return -1;
+    }
+    if (threads < 1 || (march_threads < 0 && march_threads != MARCH_THREADS_CORES))
+    {
+        PyErr_SetString(PyExc_ValueError, "threads must be positive");
+        return -1;
+    }
+    if (eng->engine)
+    {
+        PyErr_SetString(PyExc_RuntimeError, "Engine is already initialized");
+        return -1;
+    }
+
+    // init_contour_map() exits the process on a missing template
+    if (access("./contours/0.ppm", R_OK))
+    {
+        PyErr_SetString(PyExc_FileNotFoundError, "The contour templates are read from ./contours");
+        return -1;
+    }
+
+    eng->engine = contour_engine_create(threads, march_threads);
+    return 0;
+}
+
+static void engine_dealloc(PyObject *self)
+{
+    Engine *eng = (Engine *)self;
+
+    if (eng->engine)
+    {
+        Py_BEGIN_ALLOW_THREADS
+        contour_engine_destroy(eng->engine);
+        Py_END_ALLOW_THREADS
+    }
+    Py_TYPE(self)->tp_free(self);
+}
+
+// Images larger than RESCALE_X x RESCALE_Y are only read, so they are used in place. Smaller
+// ones are contoured in place, which means a copy unless the caller passes inplace=True with a
+// writable buffer.
+static PyObject *engine_contour(PyObject *self, PyObject *args, PyObject *kwds)
+{
+    static char *keywords[] = {"image", "grid", "vector", "inplace", NULL};
+    Engine *eng = (Engine *)self;
+    PyObject *obj;
+    int want_grid = 0, want_vector = 0, inplace = 0;
+    Py_buffer view;
+
+    if (!eng->engine)
+    {
+        PyErr_SetString(PyExc_RuntimeError, "Engine is not initialized");
+        return NULL;
+    }
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "O|ppp", keywords, &obj, &want_grid, &want_vector, &inplace))
+    {
+        return NULL;
+    }
+    if (PyObject_GetBuffer(obj, &view, PyBUF_C_CONTIGUOUS | PyBUF_FORMAT | (inplace ? PyBUF_WRITABLE : 0)))
+    {
+        return NULL;
+    }
+
+    int gray = view.ndim == 2;
+    if ((view.format && strcmp(view.format, "B")) || view.itemsize != 1 || (view.ndim != 3 && !gray) ||
+        (!gray && view.shape[2] != 3) || view.shape[0] < STEP || view.shape[1] < STEP ||
+        view.shape[0] > INT_MAX || view.shape[1] > INT_MAX)
+    {
+        PyBuffer_Release(&view);
+        PyErr_SetString(PyExc_ValueError, "Expected a C-contiguous uint8 buffer of shape HxWx3 or HxW");
+        return NULL;
+    }
+    if (gray && inplace)
+    {
+        PyBuffer_Release(&view);
+        PyErr_SetString(PyExc_ValueError, "HxW images cannot be contoured in place");
+        return NULL;
+    }
+
+    int x = (int)view.shape[1];
+    int y = (int)view.shape[0];
+    int rescaled = x > RESCALE_X || y > RESCALE_Y;
+    ppm_image *image;
+
+    if (gray)
+    {
+        const unsigned char *in = (const unsigned char *)view.buf;
+
+        image = allocate_image(x, y);
+        for (Py_ssize_t k = 0; k < view.len; k++)
+        {
+            image->data[k].red = image->data[k].green = image->data[k].blue = in[k];
+        }
+        rescaled = 0;
+    }
+    else if (rescaled || inplace)
+    {
+        image = (ppm_image *)malloc(sizeof(ppm_image));
+        if (!image)
+        {
+            PyBuffer_Release(&view);
+            return PyErr_NoMemory();
+        }
+        image->x = x;
+        image->y = y;
+        image->data = (ppm_pixel *)view.buf;
+    }
+    else
+    {
+        image = allocate_image(x, y);
+        memcpy(image->data, view.buf, view.len);
+    }
+
+    int borrowed = !gray && (rescaled || inplace);
+    int outputs = (want_grid ? CONTOUR_GRID : 0) | (want_vector ? CONTOUR_VECTOR : 0);
+    if (borrowed)
+    {
+        outputs |= CONTOUR_BORROWED;
+    }
+
+    ppm_image *result;
+    unsigned char **grid;
+    int rows = 0, columns = 0;
+    contour_index *index;
+
+    Py_BEGIN_ALLOW_THREADS
+    contour_job *job = contour_submit(eng->engine, image, outputs, NULL, NULL);
+    result = contour_wait(job);
+    grid = contour_take_grid(job, &rows, &columns);
+    index = contour_take_index(job);
+    contour_job_free(job);
+    Py_END_ALLOW_THREADS
+
+    Buffer *out;
+    if (result == image && inplace)
+    {
+        // the contour was drawn over the caller's buffer, which the result keeps alive
+        out = image_buffer(result, BUFFER_INPUT);
+        if (out)
+        {
+            out->input = view;
+        }
+        else
+        {
+            free(image);
+            PyBuffer_Release(&view);
+        }
+    }
+    else
+    {
+        if (borrowed)
+        {
+            free(image);
+        }
+        PyBuffer_Release(&view);
+        out = image_buffer(result, BUFFER_IMAGE);
+        if (!out)
+        {
+            free(result->data);
+            free(result);
+        }
+    }
+
+    if (!want_grid && !want_vector)
+    {
+        return (PyObject *)out;
+    }
+
+    PyObject *grid_out = Py_None, *segments_out = Py_None;
+    Py_INCREF(Py_None);
+    Py_INCREF(Py_None);
+    if (grid)
+    {
+        Py_DECREF(grid_out);
+        grid_out = (PyObject *)grid_buffer(grid, rows, columns);
+    }
+    if (index)
+    {
+        Py_DECREF(segments_out);
+        segments_out = (PyObject *)segments_buffer(index);
+    }
+
+    if (!out || !grid_out || !segments_out)
+    {
+        Py_XDECREF(out);
+        Py_XDECREF(grid_out);
+        Py_XDECREF(segments_out);
+        return NULL;
+    }
+
+    return Py_BuildValue("(NNN)", out, grid_out, segments_out);
+}
+
+static PyMethodDef engine_methods[] = {
+    {"contour", (PyCFunction)(void (*)(void))engine_contour, METH_VARARGS | METH_KEYWORDS,
+     "contour(image, grid=False, vector=False, inplace=False)\n\n"
+     "Contours an HxWx3 uint8 image on the worker pool, without holding the GIL. Returns the\n"
+     "contour image, or (image, grid, segments) if grid or vector is set: the sample grid as\n"
+     "uint8 and the contour segments as rows of int32 (x0, y0, x1, y1)."},
+    {NULL, NULL, 0, NULL},
+};
+
+static PyTypeObject EngineType = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    .tp_name = "pytema1.Engine",
+    .tp_doc = "Engine(threads, march_threads=0): a persistent pool of worker threads. march_threads=-1 runs the "
+              "march on one thread per physical core.",
+    .tp_basicsize = sizeof(Engine),
+    .tp_flags = Py_TPFLAGS_DEFAULT,
+    .tp_new = PyType_GenericNew,
+    .tp_init = engine_init,
+    .tp_dealloc = engine_dealloc,
+    .tp_methods = engine_methods,
+};
+
+static struct PyModuleDef pytema1_module = {
+    PyModuleDef_HEAD_INIT,
+    .m_name = "pytema1",
+    .m_doc = "Contouring of images held in Python buffers.",
+    .m_size = -1,
+};
+
+PyMODINIT_FUNC PyInit_pytema1(void)
+{
+    if (PyType_Ready(&BufferType) < 0 || PyType_Ready(&EngineType) < 0)
+    {
+        return NULL;
+    }
+
+    PyObject *module = PyModule_Create(&pytema1_module);
+    if (!module)
+    {
+        return NULL;
+    }
+
+    Py_INCREF(&EngineType);
+    if (PyModule_AddObject(module, "Engine", (PyObject *)&EngineType) < 0)
+    {
+        Py_DECREF(&EngineType);
+        Py_DECREF(module);
+        return NULL;
+    }
+
+    return module;
+}
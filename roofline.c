@@ -0,0 +1,344 @@
+#include "roofline.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+
+// Doubles per STREAM array (32 MB), well above the size of the last level cache.
+#define STREAM_SIZE         (4 << 20)
+#define STREAM_REPEATS      3
+#define FLOPS_ITERATIONS    (1 << 24)
+#define FLOPS_CHAINS        8
+#define BAR_WIDTH           30
+
+#define KERNEL_READ     0
+#define KERNEL_WRITE    1
+#define KERNEL_COPY     2
+#define KERNEL_FLOPS    3
+
+// The ceilings have to reflect the hardware and not the build flags of the pipeline, so the
+// measuring kernels are always optimized.
+#define LIMIT_KERNEL __attribute__((optimize("O2"), noinline))
+
+typedef struct stream_arg
+{
+    int thread_id;
+    int N;
+    int kernel;
+    double *a, *b;
+    pthread_barrier_t *barrier;
+    double elapsed;
+    double result;
+} stream_arg;
+
+static void *roofline_alloc(size_t size)
+{
+    void *ptr = malloc(size);
+    if (!ptr)
+    {
+        fprintf(stderr, "Unable to allocate memory\n");
+        exit(1);
+    }
+    return ptr;
+}
+
+double phase_clock()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+phase_stats *create_phase_stats(int N)
+{
+    phase_stats *stats = (phase_stats *)roofline_alloc(sizeof(phase_stats));
+
+    stats->N = N;
+    for (int ph = 0; ph < PHASE_COUNT; ph++)
+    {
+        stats->active[ph] = N;
+    }
+    stats->done = (double *)roofline_alloc(N * PHASE_COUNT * sizeof(double));
+    stats->released = (double *)roofline_alloc(N * PHASE_COUNT * sizeof(double));
+    stats->start = phase_clock();
+
+    return stats;
+}
+
+void phase_done(phase_stats *stats, int thread_id, int phase)
+{
+    stats->done[thread_id * PHASE_COUNT + phase] = phase_clock();
+}
+
+void phase_released(phase_stats *stats, int thread_id, int phase)
+{
+    stats->released[thread_id * PHASE_COUNT + phase] = phase_clock();
+}
+
+static double phase_begin(phase_stats *stats, int thread_id, int phase)
+{
+    return phase ? stats->released[thread_id * PHASE_COUNT + phase - 1] : stats->start;
+}
+
+// Time between the end of the previous phase and the end of this one, as seen by thread 0.
+double phase_wall(phase_stats *stats, int phase)
+{
+    return stats->released[phase] - phase_begin(stats, 0, phase);
+}
+
+// Average time the working threads spent on the phase, the rest was spent waiting at the barrier.
+double phase_busy(phase_stats *stats, int phase)
+{
+    double busy = 0;
+
+    for (int t = 0; t < stats->active[phase]; t++)
+    {
+        busy += stats->done[t * PHASE_COUNT + phase] - phase_begin(stats, t, phase);
+    }
+
+    return busy / stats->active[phase];
+}
+
+void free_phase_stats(phase_stats *stats)
+{
+    free(stats->done);
+    free(stats->released);
+    free(stats);
+}
+
+LIMIT_KERNEL static double kernel_read(double *a, size_t n)
+{
+    double s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+    for (size_t i = 0; i + 4 <= n; i += 4)
+    {
+        s0 += a[i];
+        s1 += a[i + 1];
+        s2 += a[i + 2];
+        s3 += a[i + 3];
+    }
+    return s0 + s1 + s2 + s3;
+}
+
+LIMIT_KERNEL static void kernel_write(double *a, size_t n)
+{
+    for (size_t i = 0; i < n; i++)
+    {
+        a[i] = 1.0;
+    }
+}
+
+LIMIT_KERNEL static void kernel_copy(double *a, double *b, size_t n)
+{
+    for (size_t i = 0; i < n; i++)
+    {
+        a[i] = b[i];
+    }
+}
+
+// Independent multiply-add chains of single precision floats, the type used by the resampling.
+LIMIT_KERNEL static double kernel_flops(float seed)
+{
+    float acc[FLOPS_CHAINS];
+    for (int k = 0; k < FLOPS_CHAINS; k++)
+    {
+        acc[k] = seed + k;
+    }
+
+    for (int i = 0; i < FLOPS_ITERATIONS; i++)
+    {
+        for (int k = 0; k < FLOPS_CHAINS; k++)
+        {
+            acc[k] = acc[k] * 0.999999f + 0.000001f;
+        }
+    }
+
+    double sum = 0;
+    for (int k = 0; k < FLOPS_CHAINS; k++)
+    {
+        sum += acc[k];
+    }
+    return sum;
+}
+
+static void *stream_thread(void *arg)
+{
+    stream_arg *sa = (stream_arg *)arg;
+    size_t start = (size_t)sa->thread_id * STREAM_SIZE / sa->N;
+    size_t end = (size_t)(sa->thread_id + 1) * STREAM_SIZE / sa->N;
+
+    pthread_barrier_wait(sa->barrier);
+    double t0 = phase_clock();
+
+    switch (sa->kernel)
+    {
+    case KERNEL_READ:
+        sa->result = kernel_read(sa->a + start, end - start);
+        break;
+    case KERNEL_WRITE:
+        kernel_write(sa->a + start, end - start);
+        break;
+    case KERNEL_COPY:
+        kernel_copy(sa->a + start, sa->b + start, end - start);
+        break;
+    default:
+        sa->result = kernel_flops(sa->thread_id);
+        break;
+    }
+
+    pthread_barrier_wait(sa->barrier);
+    sa->elapsed = phase_clock() - t0;
+
+    return NULL;
+}
+
+// Best time of STREAM_REPEATS runs of `kernel` on N threads.
+static double run_kernel(int kernel, int N, double *a, double *b)
+{
+    pthread_t *threads = (pthread_t *)roofline_alloc(N * sizeof(pthread_t));
+    stream_arg *args = (stream_arg *)roofline_alloc(N * sizeof(stream_arg));
+    pthread_barrier_t barrier;
+    double best = 0;
+
+    for (int r = 0; r < STREAM_REPEATS; r++)
+    {
+        pthread_barrier_init(&barrier, NULL, N);
+        for (int t = 0; t < N; t++)
+        {
+            args[t] = (stream_arg){t, N, kernel, a, b, &barrier, 0, 0};
+            pthread_create(&threads[t], NULL, stream_thread, &args[t]);
+        }
+        for (int t = 0; t < N; t++)
+        {
+            pthread_join(threads[t], NULL);
+        }
+        pthread_barrier_destroy(&barrier);
+
+        if (r == 0 || args[0].elapsed < best)
+        {
+            best = args[0].elapsed;
+        }
+    }
+
+    free(threads);
+    free(args);
+    return best;
+}
+
+// Online CPUs that are the first hardware thread of their core, i.e. the number of physical
+// cores. Falls back to the number of online CPUs when the topology is not exported.
+int count_physical_cores()
+{
+    long cpus = sysconf(_SC_NPROCESSORS_CONF);
+    int cores = 0;
+    char path[96];
+
+    for (long cpu = 0; cpu < cpus; cpu++)
+    {
+        // offline CPUs have no topology directory
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%ld/topology/thread_siblings_list", cpu);
+        FILE *fp = fopen(path, "r");
+        if (!fp)
+        {
+            continue;
+        }
+
+        long first;
+        if (fscanf(fp, "%ld", &first) == 1 && first == cpu)
+        {
+            cores++;
+        }
+        fclose(fp);
+    }
+
+    if (cores == 0)
+    {
+        cores = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    }
+    return cores > 0 ? cores : 1;
+}
+
+void measure_machine(machine_limits *limits, int N)
+{
+    size_t bytes = (size_t)STREAM_SIZE * sizeof(double);
+    double *a = (double *)roofline_alloc(bytes);
+    double *b = (double *)roofline_alloc(bytes);
+
+    // fault the pages in before timing anything
+    memset(a, 0, bytes);
+    memset(b, 0, bytes);
+
+    limits->read_bw = bytes / run_kernel(KERNEL_READ, N, a, b);
+    limits->write_bw = bytes / run_kernel(KERNEL_WRITE, N, a, b);
+    limits->copy_bw = 2.0 * bytes / run_kernel(KERNEL_COPY, N, a, b);
+    limits->peak_flops = 2.0 * FLOPS_CHAINS * FLOPS_ITERATIONS * N / run_kernel(KERNEL_FLOPS, N, a, b);
+
+    free(a);
+    free(b);
+}
+
+static void print_bar(FILE *fp, const char *label, double fraction)
+{
+    int filled = (int)(fraction * BAR_WIDTH + 0.5);
+    if (filled > BAR_WIDTH)
+    {
+        filled = BAR_WIDTH;
+    }
+
+    fprintf(fp, "    %-10s |", label);
+    for (int k = 0; k < BAR_WIDTH; k++)
+    {
+        fputc(k < filled ? '#' : '.', fp);
+    }
+    fprintf(fp, "| %5.1f%%\n", fraction * 100);
+}
+
+// Places every phase against the measured ceilings. The copy bandwidth is used as the memory
+// ceiling since every phase both reads and writes. A phase whose threads spend more than a
+// quarter of its time at the barrier is reported as bound by synchronization.
+void report_roofline(FILE *fp, phase_stats *stats, phase_work work[PHASE_COUNT], machine_limits *limits)
+{
+    static const char *names[PHASE_COUNT] = {"rescale", "sample_grid", "march"};
+
+    fprintf(fp, "machine: read %.2f GB/s, write %.2f GB/s, copy %.2f GB/s, scalar peak %.2f GFLOP/s\n",
+            limits->read_bw * 1e-9, limits->write_bw * 1e-9, limits->copy_bw * 1e-9, limits->peak_flops * 1e-9);
+
+    for (int ph = 0; ph < PHASE_COUNT; ph++)
+    {
+        double wall = phase_wall(stats, ph);
+        double busy = phase_busy(stats, ph);
+
+        if (work[ph].bytes == 0 && work[ph].flops == 0)
+        {
+            fprintf(fp, "%-11s %9.3f ms  (skipped)\n", names[ph], wall * 1e3);
+            continue;
+        }
+
+        double bw = work[ph].bytes / wall;
+        double flops = work[ph].flops / wall;
+        double bw_fraction = bw / limits->copy_bw;
+        double flop_fraction = flops / limits->peak_flops;
+        double waiting = wall > 0 ? 1.0 - busy / wall : 0;
+
+        const char *bound;
+        if (waiting > 0.25)
+        {
+            bound = "synchronization";
+        }
+        else if (flop_fraction >= bw_fraction)
+        {
+            bound = "compute";
+        }
+        else
+        {
+            bound = "bandwidth";
+        }
+
+        fprintf(fp, "%-11s %9.3f ms  %2d/%-2d threads  %8.2f GB/s  %8.2f GFLOP/s  waiting %4.1f%%  -> %s bound%s\n",
+                names[ph], wall * 1e3, stats->active[ph], stats->N, bw * 1e-9, flops * 1e-9, waiting * 100, bound,
+                bw_fraction < 0.2 && flop_fraction < 0.2 ? " (far from both ceilings)" : "");
+        print_bar(fp, "bandwidth", bw_fraction);
+        print_bar(fp, "flops", flop_fraction);
+    }
+}
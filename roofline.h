@@ -0,0 +1,54 @@
+#ifndef ROOFLINE_H
+#define ROOFLINE_H
+
+#include "helpers.h"
+
+#define PHASE_RESCALE   0
+#define PHASE_SAMPLE    1
+#define PHASE_MARCH     2
+#define PHASE_COUNT     3
+
+// Timestamps taken by every thread around the barriers that end the phases of apeleaza().
+// done[t * PHASE_COUNT + ph] is when thread t finished its share of phase ph and
+// released[...] when it left the barrier that ends it.
+typedef struct phase_stats
+{
+    int N;
+    // threads that work in each phase, the others only wait at the barrier that ends it
+    int active[PHASE_COUNT];
+    double start;
+    double *done;
+    double *released;
+} phase_stats;
+
+// Bytes moved from / to memory and floating point operations done by one phase, from a simple
+// model of each kernel.
+typedef struct phase_work
+{
+    double bytes;
+    double flops;
+} phase_work;
+
+// Sustainable bandwidth (bytes/s) and scalar peak (flops/s) of the host, measured with
+// STREAM-like kernels on N threads.
+typedef struct machine_limits
+{
+    double read_bw;
+    double write_bw;
+    double copy_bw;
+    double peak_flops;
+} machine_limits;
+
+double phase_clock();
+phase_stats *create_phase_stats(int N);
+void phase_done(phase_stats *stats, int thread_id, int phase);
+void phase_released(phase_stats *stats, int thread_id, int phase);
+double phase_wall(phase_stats *stats, int phase);
+double phase_busy(phase_stats *stats, int phase);
+void free_phase_stats(phase_stats *stats);
+
+int count_physical_cores();
+void measure_machine(machine_limits *limits, int N);
+void report_roofline(FILE *fp, phase_stats *stats, phase_work work[PHASE_COUNT], machine_limits *limits);
+
+#endif
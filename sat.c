@@ -0,0 +1,129 @@
+#include "sat.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+#define CLAMP(v, min, max) if(v < min) { v = min; } else if(v > max) { v = max; }
+
+sat *allocate_sat(ppm_image *image)
+{
+    sat *table = (sat *)malloc(sizeof(sat));
+    if (!table)
+    {
+        fprintf(stderr, "Unable to allocate memory\n");
+        exit(1);
+    }
+
+    table->x = image->x;
+    table->y = image->y;
+    table->sum = (uint32_t *)calloc((size_t)(image->x + 1) * (image->y + 1), sizeof(uint32_t));
+    if (!table->sum)
+    {
+        fprintf(stderr, "Unable to allocate memory\n");
+        exit(1);
+    }
+
+    return table;
+}
+
+// First pass: prefix sums along the rows of this thread.
+void sat_rows(sat *table, ppm_image *image, int thread_id, int N)
+{
+    int start = thread_id * image->x / N;
+    int end = (thread_id + 1) * image->x / N;
+
+    for (int r = start; r < end; r++)
+    {
+        ppm_pixel *src = &image->data[(size_t)r * image->y];
+        uint32_t *dst = &table->sum[(size_t)(r + 1) * (table->y + 1)];
+        uint32_t acc = 0;
+
+        for (int c = 0; c < image->y; c++)
+        {
+            acc += src[c].red + src[c].green + src[c].blue;
+            dst[c + 1] = acc;
+        }
+    }
+}
+
+// Second pass: prefix sums down the columns. Each thread owns a block of adjacent columns and
+// sweeps it row by row, so every access stays sequential.
+void sat_columns(sat *table, int thread_id, int N)
+{
+    int width = table->y + 1;
+    int start = thread_id * width / N;
+    int end = (thread_id + 1) * width / N;
+
+    for (int r = 1; r < table->x; r++)
+    {
+        uint32_t *above = &table->sum[(size_t)r * width];
+        uint32_t *row = above + width;
+
+        for (int c = start; c < end; c++)
+        {
+            row[c] += above[c];
+        }
+    }
+}
+
+// Same threshold as sample_grid(), applied to the mean of the window x window block around the
+// pixel at flat position `index` (cut at the borders of the image).
+static unsigned char window_sample(sat *table, int window, size_t index)
+{
+    int r = index / table->y;
+    int c = index % table->y;
+    int half = window / 2;
+
+    int r0 = r - half, r1 = r - half + window;
+    int c0 = c - half, c1 = c - half + window;
+    CLAMP(r0, 0, table->x);
+    CLAMP(r1, 0, table->x);
+    CLAMP(c0, 0, table->y);
+    CLAMP(c1, 0, table->y);
+
+    size_t width = table->y + 1;
+    uint32_t sum = table->sum[r1 * width + c1] - table->sum[r0 * width + c1] -
+                   table->sum[r1 * width + c0] + table->sum[r0 * width + c0];
+    uint32_t count = (uint32_t)(r1 - r0) * (c1 - c0);
+
+    return sum / (3 * count) > SIGMA ? 0 : 1;
+}
+
+// sample_grid() on block means instead of single pixels: the grid points are the same, but each
+// one is thresholded on the mean of the window around it, at O(1) cost whatever the window.
+// A window of 1 gives the same grid as sample_grid().
+unsigned char **sample_grid_window(sat *table, int window, unsigned char **grid, int thread_id, int N)
+{
+    int p = table->x / STEP;
+    int q = table->y / STEP;
+
+    int start = thread_id * p / N;
+    int end = (thread_id + 1) * p / N;
+
+    for (int i = start; i < end; i++)
+    {
+        for (int j = 0; j < q; j++)
+        {
+            grid[i][j] = window_sample(table, window, (size_t)i * STEP * table->y + j * STEP);
+        }
+
+        // last sample points have no neighbors to the right, as in sample_grid()
+        grid[i][q] = window_sample(table, window, (size_t)i * STEP * table->y + table->x - 1);
+    }
+    grid[p][q] = 0;
+
+    int start2 = thread_id * q / N;
+    int end2 = (thread_id + 1) * q / N;
+
+    for (int j = start2; j < end2; j++)
+    {
+        grid[p][j] = window_sample(table, window, (size_t)(table->x - 1) * table->y + j * STEP);
+    }
+
+    return grid;
+}
+
+void free_sat(sat *table)
+{
+    free(table->sum);
+    free(table);
+}
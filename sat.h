@@ -0,0 +1,22 @@
+#ifndef SAT_H
+#define SAT_H
+
+#include "helpers.h"
+
+// Summed-area table of r + g + b over an image, with a leading row and column of zeros:
+// sum[(r + 1) * (y + 1) + c + 1] is the sum over rows <= r and columns <= c (rows being
+// image->y pixels long, as in image->data). 32 bits are enough for images up to
+// RESCALE_X x RESCALE_Y, the largest image that is ever sampled.
+typedef struct sat
+{
+    int x, y;
+    uint32_t *sum;
+} sat;
+
+sat *allocate_sat(ppm_image *image);
+void sat_rows(sat *table, ppm_image *image, int thread_id, int N);
+void sat_columns(sat *table, int thread_id, int N);
+unsigned char **sample_grid_window(sat *table, int window, unsigned char **grid, int thread_id, int N);
+void free_sat(sat *table);
+
+#endif
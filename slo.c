@@ -0,0 +1,169 @@
+#include "slo.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// Measured with ./bench 512 on the reference machine, for the default -O2 build.
+void default_cost_model(cost_model *model)
+{
+    model->bicubic = 160;
+    model->bilinear = 47;
+    model->sample = 2.7;
+    model->march = 90 + 1.2;
+    model->thread = 15000;
+}
+
+// Reads the "<kernel> <ns per unit>" lines written by ./bench. Kernels that are missing keep
+// their default cost, kernels the model does not use are ignored.
+void load_cost_model(cost_model *model, const char *filename)
+{
+    char name[64];
+    double ns;
+    double update = model->march, config = 0;
+
+    FILE *fp = fopen(filename, "r");
+    if (!fp)
+    {
+        fprintf(stderr, "Unable to open file '%s'\n", filename);
+        exit(1);
+    }
+
+    while (fscanf(fp, "%63s %lf", name, &ns) == 2)
+    {
+        if (!strcmp(name, "sample_bicubic"))
+        {
+            model->bicubic = ns;
+        }
+        else if (!strcmp(name, "sample_bilinear"))
+        {
+            model->bilinear = ns;
+        }
+        else if (!strcmp(name, "sample_grid"))
+        {
+            model->sample = ns;
+        }
+        else if (!strcmp(name, "update_image"))
+        {
+            update = ns;
+        }
+        else if (!strcmp(name, "cell_config"))
+        {
+            config = ns;
+        }
+        else if (!strcmp(name, "thread_spawn"))
+        {
+            model->thread = ns;
+        }
+    }
+    fclose(fp);
+
+    model->march = update + config;
+}
+
+// Predicts the phases for one combination of settings. Threads beyond the number of online
+// CPUs only add their start-up cost.
+static double predict(cost_model *model, int source_x, int source_y, int size, int bilinear, int N,
+                      int march_threads, int cpus, slo_plan *plan)
+{
+    int rescaled = source_x > size || source_y > size;
+    int x = rescaled ? size : source_x;
+    int y = rescaled ? size : source_y;
+    double cells = (double)(x / STEP) * (y / STEP);
+    int workers = N < cpus ? N : cpus;
+    int marchers = march_threads < cpus ? march_threads : cpus;
+
+    plan->predicted_ms[PHASE_RESCALE] =
+        rescaled ? (double)x * y * (bilinear ? model->bilinear : model->bicubic) / workers * 1e-6 : 0;
+    plan->predicted_ms[PHASE_SAMPLE] = (cells + x / STEP + y / STEP + 1) * model->sample / workers * 1e-6;
+    plan->predicted_ms[PHASE_MARCH] = cells * model->march / marchers * 1e-6;
+    plan->spawn_ms = N * model->thread * 1e-6;
+
+    return plan->predicted_ms[PHASE_RESCALE] + plan->predicted_ms[PHASE_SAMPLE] +
+           plan->predicted_ms[PHASE_MARCH] + plan->spawn_ms;
+}
+
+// Picks the best quality that is predicted to fit in `target_ms`: the largest rescaled size
+// first, bicubic before bilinear at the same size, and for each of them the thread count (at
+// most P) with the smallest predicted time. If nothing fits, the cheapest settings are used.
+void plan_slo(cost_model *model, int source_x, int source_y, int P, double target_ms, slo_plan *plan)
+{
+    static const int sizes[SLO_SIZE_COUNT] = SLO_SIZES;
+    int cpus = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    int cores = count_physical_cores();
+    slo_plan candidate, cheapest;
+    double cheapest_ms = 0;
+
+    for (int s = 0; s < SLO_SIZE_COUNT; s++)
+    {
+        int rescaled = source_x > sizes[s] || source_y > sizes[s];
+
+        for (int bilinear = 0; bilinear <= rescaled; bilinear++)
+        {
+            double best_ms = 0;
+
+            for (int N = 1; N <= P; N++)
+            {
+                int march_threads = N < cores ? N : cores;
+                double ms = predict(model, source_x, source_y, sizes[s], bilinear, N, march_threads, cpus, &candidate);
+
+                if (N == 1 || ms < best_ms)
+                {
+                    best_ms = ms;
+                    *plan = candidate;
+                    plan->size = rescaled ? sizes[s] : 0;
+                    plan->bilinear = bilinear;
+                    plan->N = N;
+                    plan->march_threads = march_threads;
+                }
+            }
+
+            plan->target_ms = target_ms;
+            plan->met = best_ms <= target_ms;
+            if (plan->met)
+            {
+                return;
+            }
+
+            if (cheapest_ms == 0 || best_ms < cheapest_ms)
+            {
+                cheapest_ms = best_ms;
+                cheapest = *plan;
+            }
+        }
+    }
+
+    *plan = cheapest;
+}
+
+// Prints the chosen settings and, for every phase, the predicted time next to the one measured
+// by thread 0, so that the model can be checked against the machine it runs on.
+void report_slo(FILE *fp, slo_plan *plan, phase_stats *stats)
+{
+    static const char *names[PHASE_COUNT] = {"rescale", "sample_grid", "march"};
+    double predicted = plan->spawn_ms, actual = 0;
+
+    if (plan->size)
+    {
+        fprintf(fp, "slo: target %.1f ms, %dx%d %s, %d threads (%d in march)%s\n", plan->target_ms,
+                plan->size, plan->size, plan->bilinear ? "bilinear" : "bicubic", plan->N, plan->march_threads,
+                plan->met ? "" : ", target cannot be met");
+    }
+    else
+    {
+        fprintf(fp, "slo: target %.1f ms, not rescaled, %d threads (%d in march)%s\n", plan->target_ms,
+                plan->N, plan->march_threads, plan->met ? "" : ", target cannot be met");
+    }
+
+    fprintf(fp, "%-11s %12s %12s\n", "phase", "predicted", "actual");
+    for (int ph = 0; ph < PHASE_COUNT; ph++)
+    {
+        double wall = phase_wall(stats, ph) * 1e3;
+
+        fprintf(fp, "%-11s %9.3f ms %9.3f ms\n", names[ph], plan->predicted_ms[ph], wall);
+        predicted += plan->predicted_ms[ph];
+        actual += wall;
+    }
+    fprintf(fp, "%-11s %9.3f ms\n", "threads", plan->spawn_ms);
+    fprintf(fp, "%-11s %9.3f ms %9.3f ms\n", "total", predicted, actual);
+}
@@ -0,0 +1,39 @@
+#ifndef SLO_H
+#define SLO_H
+
+#include "helpers.h"
+#include "roofline.h"
+
+// Sides of the rescaled image tried by the latency mode, best quality first.
+#define SLO_SIZES       {RESCALE_X, 1536, 1024, 768, 512}
+#define SLO_SIZE_COUNT  5
+
+// Single thread cost of every kernel in ns per unit, as printed by ./bench (warm cache).
+typedef struct cost_model
+{
+    double bicubic;         // per rescaled pixel
+    double bilinear;        // per rescaled pixel
+    double sample;          // per grid point
+    double march;           // per cell: update_image() plus cell_config()
+    double thread;          // per worker started and joined
+} cost_model;
+
+// Settings chosen for a latency target, with the phase times they are expected to take.
+typedef struct slo_plan
+{
+    double target_ms;
+    int size;               // side of the rescaled image, 0 if the input is contoured as it is
+    int bilinear;
+    int N;
+    int march_threads;
+    int met;                // 0 if not even the cheapest settings fit in the target
+    double predicted_ms[PHASE_COUNT];
+    double spawn_ms;
+} slo_plan;
+
+void default_cost_model(cost_model *model);
+void load_cost_model(cost_model *model, const char *filename);
+void plan_slo(cost_model *model, int source_x, int source_y, int P, double target_ms, slo_plan *plan);
+void report_slo(FILE *fp, slo_plan *plan, phase_stats *stats);
+
+#endif
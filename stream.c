@@ -0,0 +1,50 @@
+#include "stream.h"
+
+void queue_init(frame_queue *queue)
+{
+    queue->head = 0;
+    queue->count = 0;
+    pthread_mutex_init(&queue->lock, NULL);
+    pthread_cond_init(&queue->not_empty, NULL);
+    pthread_cond_init(&queue->not_full, NULL);
+}
+
+// Blocks while the queue is full, which is what bounds the memory used by the stream.
+void queue_push(frame_queue *queue, ppm_image *frame)
+{
+    pthread_mutex_lock(&queue->lock);
+    while (queue->count == STREAM_QUEUE_SIZE)
+    {
+        pthread_cond_wait(&queue->not_full, &queue->lock);
+    }
+
+    queue->items[(queue->head + queue->count) % STREAM_QUEUE_SIZE] = frame;
+    queue->count++;
+
+    pthread_cond_signal(&queue->not_empty);
+    pthread_mutex_unlock(&queue->lock);
+}
+
+ppm_image *queue_pop(frame_queue *queue)
+{
+    pthread_mutex_lock(&queue->lock);
+    while (queue->count == 0)
+    {
+        pthread_cond_wait(&queue->not_empty, &queue->lock);
+    }
+
+    ppm_image *frame = queue->items[queue->head];
+    queue->head = (queue->head + 1) % STREAM_QUEUE_SIZE;
+    queue->count--;
+
+    pthread_cond_signal(&queue->not_full);
+    pthread_mutex_unlock(&queue->lock);
+    return frame;
+}
+
+void queue_destroy(frame_queue *queue)
+{
+    pthread_mutex_destroy(&queue->lock);
+    pthread_cond_destroy(&queue->not_empty);
+    pthread_cond_destroy(&queue->not_full);
+}
@@ -0,0 +1,24 @@
+#ifndef STREAM_H
+#define STREAM_H
+
+#include "helpers.h"
+#include <pthread.h>
+
+// Frames handed between the reader, the workers and the writer of the streaming mode.
+#define STREAM_QUEUE_SIZE 1
+
+// Bounded blocking queue of images. NULL is a valid item and marks the end of the stream.
+typedef struct frame_queue
+{
+    ppm_image *items[STREAM_QUEUE_SIZE];
+    int head, count;
+    pthread_mutex_t lock;
+    pthread_cond_t not_empty, not_full;
+} frame_queue;
+
+void queue_init(frame_queue *queue);
+void queue_push(frame_queue *queue, ppm_image *frame);
+ppm_image *queue_pop(frame_queue *queue);
+void queue_destroy(frame_queue *queue);
+
+#endif
@@ -1,11 +1,34 @@
 // Author: APD team, except where source was noted
 
 #include "helpers.h"
+#include "mosaic.h"
+#include "pyramid.h"
+#include "tiled.h"
+#include "vector.h"
+#include "digest.h"
+#include "contour.h"
+#include "roofline.h"
+#include "stream.h"
+#include "ingest.h"
+#include "sat.h"
+#include "adaptive.h"
+#include "slo.h"
+#include "polygon.h"
+#include "geometry.h"
+#include "async.h"
+#include "watch.h"
+#include "farm.h"
+#include "change.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
 #include <pthread.h>
+#include <limits.h>
+#include <sys/stat.h>
+#include <sys/eventfd.h>
+#include <time.h>
+#include <math.h>
 
 #define CONTOUR_CONFIG_COUNT 16
 #define FILENAME_MAX_SIZE 50
@@ -14,6 +37,9 @@
 #define RESCALE_X 2048
 #define RESCALE_Y 2048
 
+// Output pixels per side of the tiles rescale_image() walks.
+#define AFFINE_TILE 32
+
 #define CLAMP(v, min, max) \
     if (v < min)           \
     {                      \
@@ -33,266 +59,1435 @@ typedef struct image
     ppm_image **contour_map;
     pthread_barrier_t *barrier;
     int N;
+    mosaic *mosaic;
+    ppm_image **levels;
+    unsigned char ***level_grids;
+    int level_count;
+    tiled_file *tiled;
+    contour_index *index;
+    uint64_t *band_hashes;
+    phase_stats *stats;
+    row_source *source;
+    pread_source *loader;
+    pbm_mask *mask;
+    int runs;
+    sat *sat;
+    int window;
+    tile_stats *adaptive;
+    int march_threads;
+    int bilinear;
+    overlay_tile *overlay;
+    polygon_set *polygons;
+    int rings;
+    geometry_writer *geometry;
+    change_set *change;
+    const float *affine;
 } image;
 
-// Creates a map between the binary configuration (e.g. 0110_2) and the corresponding pixels
-// that need to be set on the output image. An array is used for this map since the keys are
-// binary numbers in 0-15. Contour images are located in the './contours' directory.
-ppm_image **init_contour_map()
+typedef struct options
+{
+    int mosaic;
+    int pyramid_levels;
+    int tile;
+    const char *vector;
+    int digest;
+    int roofline;
+    int pread;
+    int runs;
+    int window;
+    int adaptive;
+    int march_threads;
+    double slo;
+    const char *cost_model;
+    int overlay;
+    const char *polygons;
+    const char *geometry;
+    int farm;
+    int lease;
+    const char *change;
+    const char *change_mask;
+    int affine;
+    float matrix[6];
+    double deskew;
+} options;
+
+// Inverse affine map of the resampler when there is no transform.
+static const float identity_affine[6] = {1, 0, 0, 0, 1, 0};
+
+// Inverse map of a rotation by `degrees` around the center of an x * y image, in the normalized
+// coordinates of rescale_image(): it undoes a scan rotated clockwise by `degrees`.
+void deskew_matrix(float m[6], double degrees, int x, int y)
+{
+    double c = cos(degrees * M_PI / 180);
+    double s = sin(degrees * M_PI / 180);
+
+    m[0] = c;
+    m[1] = -s * y / x;
+    m[2] = 0.5 - 0.5 * (m[0] + m[1]);
+    m[3] = s * x / y;
+    m[4] = c;
+    m[5] = 0.5 - 0.5 * (m[3] + m[4]);
+}
+
+// Output pixel (i, j) samples the input at (u, v) = (i / (x - 1), j / (y - 1)) mapped through
+// the inverse affine transform `imagine->affine`, so deskewing and resizing are one pass. The
+// output is walked in AFFINE_TILE x AFFINE_TILE tiles, which map to compact areas of the source
+// whatever the rotation. Points that map outside the source are white.
+ppm_image *rescale_image(struct image *imagine)
+{
+    uint8_t sample[3];
+
+    ppm_image *image = imagine->image;
+    ppm_image *new_image = imagine->scaled_image;
+    const float *m = imagine->affine ? imagine->affine : identity_affine;
+
+    // use bicubic interpolation for scaling
+    int start = imagine->thread_id * new_image->x / imagine->N;
+    int end = (imagine->thread_id + 1) * new_image->x / imagine->N;
+    if (end > new_image->x)
+    {
+        end = new_image->x;
+    }
+
+    for (int i0 = start; i0 < end; i0 += AFFINE_TILE)
+    {
+        for (int j0 = 0; j0 < new_image->y; j0 += AFFINE_TILE)
+        {
+            for (int i = i0; i < i0 + AFFINE_TILE && i < end; i++)
+            {
+                for (int j = j0; j < j0 + AFFINE_TILE && j < new_image->y; j++)
+                {
+                    float u = (float)i / (float)(new_image->x - 1);
+                    float v = (float)j / (float)(new_image->y - 1);
+                    float su = m[0] * u + m[1] * v + m[2];
+                    float sv = m[3] * u + m[4] * v + m[5];
+
+                    if (su < 0 || su > 1 || sv < 0 || sv > 1)
+                    {
+                        sample[0] = sample[1] = sample[2] = RGB_COMPONENT_COLOR;
+                    }
+                    else if (imagine->bilinear)
+                    {
+                        sample_bilinear(image, su, sv, sample);
+                    }
+                    else
+                    {
+                        sample_bicubic(image, su, sv, sample);
+                    }
+
+                    new_image->data[i * new_image->y + j].red = sample[0];
+                    new_image->data[i * new_image->y + j].green = sample[1];
+                    new_image->data[i * new_image->y + j].blue = sample[2];
+
+                    if (imagine->adaptive)
+                    {
+                        tile_stats_add(imagine->adaptive, imagine->thread_id, i, j, sample);
+                    }
+                }
+            }
+        }
+    }
+
+    return new_image;
+}
+
+// Output columns rescaled between two checks of the watermark of the source rows.
+#define RESCALE_BAND 16
+
+// Same as rescale_image, while the source is still being read. The output columns map to source
+// rows, so they are done in bands of RESCALE_BAND and every band only waits for the rows under
+// its 4-tap window instead of the whole file.
+ppm_image *rescale_progressive(struct image *imagine)
+{
+    uint8_t sample[3];
+
+    ppm_image *image = imagine->image;
+    ppm_image *new_image = imagine->scaled_image;
+
+    int start = imagine->thread_id * new_image->x / imagine->N;
+    int end = (imagine->thread_id + 1) * new_image->x / imagine->N;
+
+    for (int j_start = 0; j_start < new_image->y; j_start += RESCALE_BAND)
+    {
+        int j_end = j_start + RESCALE_BAND < new_image->y ? j_start + RESCALE_BAND : new_image->y;
+
+        // same source row computation as in sample_bicubic_band, for the last column of the band
+        float v = (float)(j_end - 1) / (float)(new_image->y - 1);
+        float y = (v * image->y) - 0.5;
+        wait_rows(imagine->source, (int)y + 3);
+
+        for (int i = start; i < end && i < new_image->x; i++)
+        {
+            for (int j = j_start; j < j_end; j++)
+            {
+                float u = (float)i / (float)(new_image->x - 1);
+                float v = (float)j / (float)(new_image->y - 1);
+                if (imagine->bilinear)
+                {
+                    sample_bilinear(image, u, v, sample);
+                }
+                else
+                {
+                    sample_bicubic(image, u, v, sample);
+                }
+
+                new_image->data[i * new_image->y + j].red = sample[0];
+                new_image->data[i * new_image->y + j].green = sample[1];
+                new_image->data[i * new_image->y + j].blue = sample[2];
+
+                if (imagine->adaptive)
+                {
+                    tile_stats_add(imagine->adaptive, imagine->thread_id, i, j, sample);
+                }
+            }
+        }
+    }
+
+    return new_image;
+}
+
+// Rescales a mosaic one tile row at a time. Thread 0 slides the band down to the next tile
+// row (plus halo) while the others wait, then every thread fills, on its own output rows, the
+// columns whose bicubic window starts inside that tile row.
+ppm_image *rescale_mosaic(struct image *imagine)
+{
+    uint8_t sample[3];
+
+    mosaic *m = imagine->mosaic;
+    ppm_image *new_image = imagine->scaled_image;
+
+    int start = imagine->thread_id * new_image->x / imagine->N;
+    int end = (imagine->thread_id + 1) * new_image->x / imagine->N;
+
+    int j_start = 0;
+    for (int r = 0; r < m->rows; r++)
+    {
+        int lo = m->row_y[r] - MOSAIC_HALO;
+        int hi = m->row_y[r + 1] + MOSAIC_HALO;
+        CLAMP(lo, 0, m->y);
+        CLAMP(hi, 0, m->y);
+
+        if (imagine->thread_id == 0)
+        {
+            mosaic_load_rows(m, lo, hi);
+        }
+        pthread_barrier_wait(imagine->barrier);
+
+        // same source row computation as in sample_bicubic_band
+        int j_end = j_start;
+        while (j_end < new_image->y)
+        {
+            float v = (float)j_end / (float)(new_image->y - 1);
+            float y = (v * m->y) - 0.5;
+            if ((int)y >= m->row_y[r + 1] && r < m->rows - 1)
+            {
+                break;
+            }
+            j_end++;
+        }
+
+        for (int i = start; i < end && i < new_image->x; i++)
+        {
+            for (int j = j_start; j < j_end; j++)
+            {
+                float u = (float)i / (float)(new_image->x - 1);
+                float v = (float)j / (float)(new_image->y - 1);
+                sample_bicubic_band(&m->band, m->y, m->row0, u, v, sample);
+
+                new_image->data[i * new_image->y + j].red = sample[0];
+                new_image->data[i * new_image->y + j].green = sample[1];
+                new_image->data[i * new_image->y + j].blue = sample[2];
+
+                if (imagine->adaptive)
+                {
+                    tile_stats_add(imagine->adaptive, imagine->thread_id, i, j, sample);
+                }
+            }
+        }
+        j_start = j_end;
+
+        // the band is about to be overwritten
+        pthread_barrier_wait(imagine->barrier);
+    }
+
+    return new_image;
+}
+
+ppm_image *allocate_rescale()
+{
+    return allocate_image(RESCALE_X, RESCALE_Y);
+}
+
+// Returns the thread whose march() range covers every image row of tile row `ti`, or -1 if the
+// tile row straddles two threads. Rows below the last grid row belong to the last thread.
+int tile_row_owner(ppm_image *image, tiled_file *tf, int ti, int N)
+{
+    int p = image->x / STEP;
+    int lo = ti * tf->tile;
+    int hi = lo + tf->tile < image->x ? lo + tf->tile : image->x;
+
+    for (int t = 0; t < N; t++)
+    {
+        int first = t * p / N * STEP;
+        int last = t == N - 1 ? image->x : (t + 1) * p / N * STEP;
+
+        if (lo >= first && hi <= last)
+        {
+            return t;
+        }
+    }
+
+    return -1;
+}
+
+// Writes tiles of the contour image to the container. Right after its own march() a thread
+// writes the tile rows it finished by itself; once every thread has passed the barrier, the tile
+// rows that straddle two threads are split between all of them.
+void write_tiles(struct image *im, int after_barrier)
+{
+    tiled_file *tf = im->tiled;
+
+    for (int ti = 0; ti < tf->tiles_x; ti++)
+    {
+        int owner = tile_row_owner(im->scaled_image, tf, ti, im->march_threads);
+
+        if ((!after_barrier && owner == im->thread_id) ||
+            (after_barrier && owner == -1 && ti % im->N == im->thread_id))
+        {
+            for (int tj = 0; tj < tf->tiles_y; tj++)
+            {
+                tiled_write_tile(tf, im->scaled_image, ti, tj);
+            }
+        }
+    }
+}
+
+// Contours every zoom level of the pyramid. The next level is reduced from the current one in
+// the same pass that samples it, since march() overwrites the current level afterwards.
+void march_pyramid(struct image *im)
+{
+    for (int k = 0; k < im->level_count; k++)
+    {
+        if (k + 1 < im->level_count)
+        {
+            downsample_level(im->levels[k], im->levels[k + 1], im->thread_id, im->N);
+        }
+        sample_grid(im->levels[k], im->level_grids[k], im->thread_id, im->N);
+        pthread_barrier_wait(im->barrier);
+        march(im->levels[k], im->level_grids[k], im->contour_map, im->thread_id, im->N);
+        pthread_barrier_wait(im->barrier);
+    }
+}
+
+// Loads this thread's share of the payload. The shares follow the rows that march() gives to
+// the thread, so when the image is not rescaled the pages are local to the thread using them.
+void load_payload(struct image *im)
+{
+    ppm_image *image = im->loader->image;
+    size_t row = (size_t)image->y * sizeof(ppm_pixel);
+    int p = image->x / STEP;
+
+    size_t begin = im->thread_id == 0 ? 0 : (size_t)(im->thread_id * p / im->N * STEP) * row;
+    size_t end = im->thread_id == im->N - 1 ? (size_t)image->x * row
+                                             : (size_t)((im->thread_id + 1) * p / im->N * STEP) * row;
+
+    pread_payload(im->loader, begin, end);
+}
+
+// Waits at the barrier that ends `phase`, recording when the thread got there and when it left
+// if the phases are being timed.
+void phase_barrier(struct image *im, int phase)
+{
+    if (im->stats)
+    {
+        phase_done(im->stats, im->thread_id, phase);
+    }
+    pthread_barrier_wait(im->barrier);
+    if (im->stats)
+    {
+        phase_released(im->stats, im->thread_id, phase);
+    }
+}
+
+void *apeleaza(void *arg)
+{
+
+    struct image *im = (struct image *)arg;
+    if (im->loader)
+    {
+        load_payload(im);
+        pthread_barrier_wait(im->barrier);
+    }
+
+    if (im->mosaic)
+    {
+        im->scaled_image = rescale_mosaic(im);
+    }
+    else if (im->source)
+    {
+        im->scaled_image = rescale_progressive(im);
+    }
+    else if (im->image != im->scaled_image)
+    {
+        im->scaled_image = rescale_image(im);
+    }
+    phase_barrier(im, PHASE_RESCALE);
+    if (im->level_count > 0)
+    {
+        march_pyramid(im);
+        return NULL;
+    }
+    if (im->mask)
+    {
+        im->grid = sample_mask_grid(im->mask, im->grid, im->thread_id, im->N);
+    }
+    else if (im->adaptive)
+    {
+        // rescaling already gathered the statistics, otherwise they take a pass of their own
+        if (im->image == im->scaled_image)
+        {
+            tile_stats_image(im->adaptive, im->scaled_image, im->thread_id, im->N);
+            pthread_barrier_wait(im->barrier);
+        }
+        tile_thresholds(im->adaptive, im->thread_id, im->N);
+        pthread_barrier_wait(im->barrier);
+        im->grid = sample_grid_adaptive(im->adaptive, im->scaled_image, im->grid, im->thread_id, im->N);
+    }
+    else if (im->sat)
+    {
+        sat_rows(im->sat, im->scaled_image, im->thread_id, im->N);
+        pthread_barrier_wait(im->barrier);
+        sat_columns(im->sat, im->thread_id, im->N);
+        pthread_barrier_wait(im->barrier);
+        im->grid = sample_grid_window(im->sat, im->window, im->grid, im->thread_id, im->N);
+    }
+    else
+    {
+        im->grid = sample_grid(im->scaled_image, im->grid, im->thread_id, im->N);
+        if (im->change)
+        {
+            sample_before(im->change, im->thread_id, im->N);
+        }
+    }
+    phase_barrier(im, PHASE_SAMPLE);
+    if (im->index)
+    {
+        // march() does not touch the grid, so the segments can be extracted right before it
+        count_segments(im->index, im->grid, im->thread_id, im->N);
+        pthread_barrier_wait(im->barrier);
+        if (im->thread_id == 0)
+        {
+            place_segments(im->index);
+        }
+        pthread_barrier_wait(im->barrier);
+        fill_segments(im->index, im->grid, im->thread_id, im->N);
+    }
+    if (im->polygons)
+    {
+        // rings are assembled per band, joined across the seams and then nested, on the grid
+        // march() leaves untouched
+        link_cells(im->polygons, im->grid, im->thread_id, im->N);
+        pthread_barrier_wait(im->barrier);
+        trace_band(im->polygons, im->thread_id);
+        pthread_barrier_wait(im->barrier);
+        if (im->geometry)
+        {
+            // the chains of every band are encoded and written as they are, in parallel
+            geometry_encode_band(im->geometry, im->polygons, im->thread_id);
+            pthread_barrier_wait(im->barrier);
+            if (im->thread_id == 0)
+            {
+                geometry_place(im->geometry);
+            }
+            pthread_barrier_wait(im->barrier);
+            geometry_write_band(im->geometry, im->thread_id);
+        }
+        if (im->rings)
+        {
+            if (im->thread_id == 0)
+            {
+                merge_seams(im->polygons);
+            }
+            pthread_barrier_wait(im->barrier);
+            nest_rings(im->polygons, im->grid, im->thread_id, im->N);
+        }
+    }
+    // march() only copies tiles, so it runs on fewer threads than the rest and the others go
+    // straight to the barrier
+    if (im->thread_id < im->march_threads)
+    {
+        if (im->band_hashes)
+        {
+            march_digest(im->scaled_image, im->grid, im->contour_map, im->band_hashes, im->thread_id,
+                         im->march_threads);
+        }
+        else if (im->overlay)
+        {
+            march_overlay(im->scaled_image, im->grid, im->overlay, im->thread_id, im->march_threads);
+        }
+        else if (im->change)
+        {
+            march_changes(im->change, im->scaled_image, im->grid, im->contour_map, im->thread_id,
+                          im->march_threads);
+        }
+        else if (im->runs)
+        {
+            march_runs(im->scaled_image, im->grid, im->contour_map, im->thread_id, im->march_threads);
+        }
+        else
+        {
+            march(im->scaled_image, im->grid, im->contour_map, im->thread_id, im->march_threads);
+        }
+    }
+    if (im->tiled)
+    {
+        write_tiles(im, 0);
+    }
+    phase_barrier(im, PHASE_MARCH);
+    if (im->tiled)
+    {
+        write_tiles(im, 1);
+    }
+
+    return NULL;
+}
+
+// Threads used by march(). By default it runs on the whole pool like rescaling. march() is a
+// bandwidth bound copy that gains nothing from a second thread on the same core, so it can be
+// limited to one thread per physical core with MARCH_THREADS_CORES (--march-threads cores).
+int march_thread_count(int N, int requested)
+{
+    int count = requested == MARCH_THREADS_CORES ? count_physical_cores() : requested ? requested : N;
+    return count < N ? count : N;
+}
+
+// Estimates the memory traffic and the floating point work of each phase. Every bicubic sample
+// evaluates cubic_hermite() 15 times (about 28 flops each) plus a few flops for the coordinates;
+// writes are counted twice because of the read for ownership.
+#define RESCALE_FLOPS_PER_PIXEL (15 * 28 + 10)
+
+void estimate_phase_work(int source_x, int source_y, ppm_image *scaled_image, int rescaled,
+                         phase_work work[PHASE_COUNT])
+{
+    double pixel = sizeof(ppm_pixel);
+    double source_bytes = (double)source_x * source_y * pixel;
+    double image_bytes = (double)scaled_image->x * scaled_image->y * pixel;
+    double p = scaled_image->x / STEP;
+    double q = scaled_image->y / STEP;
+
+    memset(work, 0, PHASE_COUNT * sizeof(phase_work));
+
+    if (rescaled)
+    {
+        work[PHASE_RESCALE].bytes = source_bytes + 2 * image_bytes;
+        work[PHASE_RESCALE].flops = (double)scaled_image->x * scaled_image->y * RESCALE_FLOPS_PER_PIXEL;
+    }
+
+    // every cache line of a sampled row is touched, since samples are only STEP pixels apart
+    work[PHASE_SAMPLE].bytes = (p + 1) * scaled_image->y * pixel + 2 * (p + 1) * (q + 1);
+    work[PHASE_MARCH].bytes = 2 * image_bytes + (p + 1) * (q + 1);
+}
+
+// Parses the optional flags that follow the three mandatory arguments.
+int parse_options(int argc, char *argv[], options *opts)
+{
+    memset(opts, 0, sizeof(options));
+
+    for (int i = 4; i < argc; i++)
+    {
+        if (!strcmp(argv[i], "--mosaic"))
+        {
+            opts->mosaic = 1;
+        }
+        else if (!strcmp(argv[i], "--pyramid") && i + 1 < argc)
+        {
+            opts->pyramid_levels = atoi(argv[++i]);
+            if (opts->pyramid_levels < 1)
+            {
+                fprintf(stderr, "Invalid number of pyramid levels\n");
+                return -1;
+            }
+        }
+        else if (!strcmp(argv[i], "--digest"))
+        {
+            opts->digest = 1;
+        }
+        else if (!strcmp(argv[i], "--window") && i + 1 < argc)
+        {
+            opts->window = atoi(argv[++i]);
+            if (opts->window < 1)
+            {
+                fprintf(stderr, "Invalid window size\n");
+                return -1;
+            }
+        }
+        else if (!strcmp(argv[i], "--change") && i + 1 < argc)
+        {
+            opts->change = argv[++i];
+        }
+        else if (!strcmp(argv[i], "--change-mask") && i + 1 < argc)
+        {
+            opts->change_mask = argv[++i];
+        }
+        else if (!strcmp(argv[i], "--affine") && i + 1 < argc)
+        {
+            float *m = opts->matrix;
+            char end;
+            if (sscanf(argv[++i], "%f,%f,%f,%f,%f,%f%c", &m[0], &m[1], &m[2], &m[3], &m[4], &m[5], &end) != 6)
+            {
+                fprintf(stderr, "Invalid affine matrix, expected a,b,c,d,e,f\n");
+                return -1;
+            }
+            opts->affine = 1;
+        }
+        else if (!strcmp(argv[i], "--deskew") && i + 1 < argc)
+        {
+            opts->deskew = atof(argv[++i]);
+            if (opts->deskew == 0)
+            {
+                fprintf(stderr, "Invalid deskew angle\n");
+                return -1;
+            }
+        }
+        else if (!strcmp(argv[i], "--farm"))
+        {
+            opts->farm = 1;
+        }
+        else if (!strcmp(argv[i], "--lease") && i + 1 < argc)
+        {
+            opts->lease = atoi(argv[++i]);
+            if (opts->lease < 1)
+            {
+                fprintf(stderr, "Invalid lease\n");
+                return -1;
+            }
+        }
+        else if (!strcmp(argv[i], "--march-threads") && i + 1 < argc)
+        {
+            i++;
+            opts->march_threads = strcmp(argv[i], "cores") ? atoi(argv[i]) : MARCH_THREADS_CORES;
+            if (opts->march_threads < 1 && opts->march_threads != MARCH_THREADS_CORES)
+            {
+                fprintf(stderr, "Invalid number of march threads\n");
+                return -1;
+            }
+        }
+        else if (!strcmp(argv[i], "--slo") && i + 1 < argc)
+        {
+            opts->slo = atof(argv[++i]);
+            if (opts->slo <= 0)
+            {
+                fprintf(stderr, "Invalid latency target\n");
+                return -1;
+            }
+        }
+        else if (!strcmp(argv[i], "--cost-model") && i + 1 < argc)
+        {
+            opts->cost_model = argv[++i];
+        }
+        else if (!strcmp(argv[i], "--polygons") && i + 1 < argc)
+        {
+            opts->polygons = argv[++i];
+        }
+        else if (!strcmp(argv[i], "--geometry") && i + 1 < argc)
+        {
+            opts->geometry = argv[++i];
+        }
+        else if (!strcmp(argv[i], "--overlay"))
+        {
+            opts->overlay = 1;
+        }
+        else if (!strcmp(argv[i], "--adaptive"))
+        {
+            opts->adaptive = 1;
+        }
+        else if (!strcmp(argv[i], "--runs"))
+        {
+            opts->runs = 1;
+        }
+        else if (!strcmp(argv[i], "--pread"))
+        {
+            opts->pread = 1;
+        }
+        else if (!strcmp(argv[i], "--roofline"))
+        {
+            opts->roofline = 1;
+        }
+        else if (!strcmp(argv[i], "--vector") && i + 1 < argc)
+        {
+            opts->vector = argv[++i];
+        }
+        else if (!strcmp(argv[i], "--tiled") && i + 1 < argc)
+        {
+            opts->tile = atoi(argv[++i]);
+            if (opts->tile < 1)
+            {
+                fprintf(stderr, "Invalid tile size\n");
+                return -1;
+            }
+        }
+        else
+        {
+            fprintf(stderr, "Unknown option '%s'\n", argv[i]);
+            return -1;
+        }
+    }
+
+    if ((opts->tile || opts->vector || opts->polygons || opts->geometry || opts->digest || opts->roofline) &&
+        opts->pyramid_levels)
+    {
+        fprintf(stderr, "--tiled, --vector, --polygons, --geometry, --digest and --roofline cannot be combined "
+                        "with --pyramid\n");
+        return -1;
+    }
+
+    if (opts->pread && opts->mosaic)
+    {
+        fprintf(stderr, "--pread cannot be combined with --mosaic\n");
+        return -1;
+    }
+
+    if (opts->runs && (opts->digest || opts->pyramid_levels))
+    {
+        fprintf(stderr, "--runs cannot be combined with --digest or --pyramid\n");
+        return -1;
+    }
+
+    if ((opts->window || opts->adaptive) && opts->pyramid_levels)
+    {
+        fprintf(stderr, "--window and --adaptive cannot be combined with --pyramid\n");
+        return -1;
+    }
+
+    if (opts->slo && (opts->mosaic || opts->pyramid_levels || opts->march_threads))
+    {
+        fprintf(stderr, "--slo cannot be combined with --mosaic, --pyramid or --march-threads\n");
+        return -1;
+    }
+
+    if (opts->affine && opts->deskew)
+    {
+        fprintf(stderr, "--affine cannot be combined with --deskew\n");
+        return -1;
+    }
+
+    if ((opts->affine || opts->deskew) && (opts->mosaic || opts->change))
+    {
+        fprintf(stderr, "--affine and --deskew cannot be combined with --mosaic or --change\n");
+        return -1;
+    }
+
+    if (opts->change_mask && !opts->change)
+    {
+        fprintf(stderr, "--change-mask needs --change\n");
+        return -1;
+    }
+
+    if (opts->change && (opts->mosaic || opts->pyramid_levels || opts->tile || opts->vector || opts->digest ||
+                         opts->runs || opts->window || opts->adaptive || opts->slo || opts->overlay ||
+                         opts->polygons || opts->geometry))
+    {
+        fprintf(stderr, "--change can only be combined with --pread, --roofline and --march-threads\n");
+        return -1;
+    }
+
+    if (opts->lease && !opts->farm)
+    {
+        fprintf(stderr, "--lease needs --farm\n");
+        return -1;
+    }
+
+    if (opts->cost_model && !opts->slo)
+    {
+        fprintf(stderr, "--cost-model needs --slo\n");
+        return -1;
+    }
+
+    if (opts->overlay && (opts->pyramid_levels || opts->digest || opts->runs))
+    {
+        fprintf(stderr, "--overlay cannot be combined with --pyramid, --digest or --runs\n");
+        return -1;
+    }
+
+    if (opts->window && opts->adaptive)
+    {
+        fprintf(stderr, "--window cannot be combined with --adaptive\n");
+        return -1;
+    }
+
+    if (opts->tile && opts->digest)
+    {
+        fprintf(stderr, "--digest does not write any image, it cannot be combined with --tiled\n");
+        return -1;
+    }
+
+    return 0;
+}
+
+// The contour templates are read from ./contours, like in the command line tool.
+contour_engine *contour_engine_create(int N, int march_threads)
 {
-    ppm_image **map = (ppm_image **)malloc(CONTOUR_CONFIG_COUNT * sizeof(ppm_image *));
-    if (!map)
+    contour_engine *engine = (contour_engine *)malloc(sizeof(contour_engine));
+    if (!engine)
     {
         fprintf(stderr, "Unable to allocate memory\n");
         exit(1);
     }
 
+    engine->pool = pool_create(N);
+    engine->contour_map = init_contour_map();
+    engine->march_threads = march_thread_count(N, march_threads);
+
+    return engine;
+}
+
+static void release_job(contour_job *job)
+{
+    if (__atomic_sub_fetch(&job->refs, 1, __ATOMIC_ACQ_REL))
+    {
+        return;
+    }
+
+    // whatever the caller did not take
+    if (job->result && job->result != job->image)
+    {
+        free(job->result->data);
+        free(job->result);
+    }
+    if (job->result == job->image && !(job->outputs & CONTOUR_BORROWED))
+    {
+        free(job->image->data);
+        free(job->image);
+    }
+    if (job->grid)
+    {
+        free_grid(job->grid, job->grid_rows - 1);
+    }
+    if (job->index)
+    {
+        free_contour_index(job->index);
+    }
+    if (job->event_fd >= 0)
+    {
+        close(job->event_fd);
+    }
+    pthread_mutex_destroy(&job->lock);
+    pthread_cond_destroy(&job->finished);
+    free(job);
+}
+
+// Runs on the worker that finished the job last.
+static void finish_job(void *data)
+{
+    contour_job *job = (contour_job *)data;
+    ppm_image *scaled_image = job->imagine[0].scaled_image;
+
+    pthread_barrier_destroy(&job->barrier);
+    free(job->imagine);
+    if (!(job->outputs & CONTOUR_GRID))
+    {
+        free_grid(job->grid, job->grid_rows - 1);
+        job->grid = NULL;
+    }
+    if (scaled_image != job->image && !(job->outputs & CONTOUR_BORROWED))
+    {
+        free(job->image->data);
+        free(job->image);
+    }
+
+    pthread_mutex_lock(&job->lock);
+    job->result = scaled_image;
+    job->done = 1;
+    if (job->event_fd >= 0)
+    {
+        uint64_t one = 1;
+        if (write(job->event_fd, &one, sizeof(one)) != sizeof(one))
+        {
+            fprintf(stderr, "Unable to signal job completion\n");
+        }
+    }
+    pthread_cond_broadcast(&job->finished);
+    pthread_mutex_unlock(&job->lock);
+
+    if (job->callback)
+    {
+        job->callback(job, job->data);
+    }
+    release_job(job);
+}
+
+// Queues the plain pipeline (rescale, sample_grid, march) of one image on the pool and returns
+// at once. The job owns the image from now on, unless `outputs` has CONTOUR_BORROWED, in which
+// case the caller frees it after the job is done. Images that need no rescaling are contoured in
+// place, so the contour image is then the input image itself. `callback`, if any, runs on a
+// worker thread once the contour image is ready and should not block.
+contour_job *contour_submit(contour_engine *engine, ppm_image *image, int outputs, contour_callback callback,
+                            void *data)
+{
+    int N = engine->pool->N;
+    contour_job *job = (contour_job *)calloc(1, sizeof(contour_job));
+    struct image *imagine = (struct image *)calloc(N, sizeof(struct image));
+
+    if (!job || !imagine)
+    {
+        fprintf(stderr, "Unable to allocate memory\n");
+        exit(1);
+    }
+
+    job->engine = engine;
+    job->image = image;
+    job->outputs = outputs;
+    job->imagine = imagine;
+    job->callback = callback;
+    job->data = data;
+    job->event_fd = -1;
+    job->refs = 2;
+    pthread_mutex_init(&job->lock, NULL);
+    pthread_cond_init(&job->finished, NULL);
+    pthread_barrier_init(&job->barrier, NULL, N);
+
+    ppm_image *scaled_image = image;
+    if (image->x > RESCALE_X || image->y > RESCALE_Y)
+    {
+        scaled_image = allocate_rescale();
+    }
+
+    job->grid = allocate_grid(scaled_image);
+    job->grid_rows = scaled_image->x / STEP + 1;
+    job->grid_columns = scaled_image->y / STEP + 1;
+    if (outputs & CONTOUR_VECTOR)
+    {
+        job->index = create_contour_index(scaled_image->x / STEP, scaled_image->y / STEP);
+    }
+
+    for (int i = 0; i < N; i++)
+    {
+        imagine[i].N = N;
+        imagine[i].thread_id = i;
+        imagine[i].image = image;
+        imagine[i].scaled_image = scaled_image;
+        imagine[i].grid = job->grid;
+        imagine[i].contour_map = engine->contour_map;
+        imagine[i].barrier = &job->barrier;
+        imagine[i].march_threads = engine->march_threads;
+        imagine[i].index = job->index;
+    }
+
+    pool_submit(engine->pool, apeleaza, imagine, sizeof(struct image), finish_job, job);
+
+    return job;
+}
+
+// An eventfd that becomes readable when the job is done, for poll() or epoll. It is created on
+// the first call and closed by contour_job_free().
+int contour_job_fd(contour_job *job)
+{
+    pthread_mutex_lock(&job->lock);
+    if (job->event_fd < 0)
+    {
+        job->event_fd = eventfd(job->done, EFD_CLOEXEC | EFD_NONBLOCK);
+        if (job->event_fd < 0)
+        {
+            fprintf(stderr, "Unable to create eventfd\n");
+            exit(1);
+        }
+    }
+    pthread_mutex_unlock(&job->lock);
+
+    return job->event_fd;
+}
+
+int contour_job_done(contour_job *job)
+{
+    pthread_mutex_lock(&job->lock);
+    int done = job->done;
+    pthread_mutex_unlock(&job->lock);
+
+    return done;
+}
+
+// Hands the contour image over to the caller. Returns NULL if the job is not done yet or the
+// image was already taken.
+ppm_image *contour_take(contour_job *job)
+{
+    ppm_image *result = NULL;
+
+    pthread_mutex_lock(&job->lock);
+    if (job->done)
+    {
+        result = job->result;
+        job->result = NULL;
+    }
+    pthread_mutex_unlock(&job->lock);
+
+    return result;
+}
+
+// Hands the sample grid over to the caller (free it with free_grid(grid, rows - 1)). It is kept
+// only for CONTOUR_GRID jobs.
+unsigned char **contour_take_grid(contour_job *job, int *rows, int *columns)
+{
+    unsigned char **grid = NULL;
+
+    pthread_mutex_lock(&job->lock);
+    if (job->done && job->grid)
+    {
+        grid = job->grid;
+        *rows = job->grid_rows;
+        *columns = job->grid_columns;
+        job->grid = NULL;
+    }
+    pthread_mutex_unlock(&job->lock);
+
+    return grid;
+}
+
+// Hands the contour segments over to the caller, for CONTOUR_VECTOR jobs.
+contour_index *contour_take_index(contour_job *job)
+{
+    contour_index *index = NULL;
+
+    pthread_mutex_lock(&job->lock);
+    if (job->done)
+    {
+        index = job->index;
+        job->index = NULL;
+    }
+    pthread_mutex_unlock(&job->lock);
+
+    return index;
+}
+
+ppm_image *contour_wait(contour_job *job)
+{
+    pthread_mutex_lock(&job->lock);
+    while (!job->done)
+    {
+        pthread_cond_wait(&job->finished, &job->lock);
+    }
+    pthread_mutex_unlock(&job->lock);
+
+    return contour_take(job);
+}
+
+// Releases the caller's handle. A contour image that was not taken is freed with the job.
+void contour_job_free(contour_job *job)
+{
+    release_job(job);
+}
+
+// Waits for the queued jobs, then stops the workers.
+void contour_engine_destroy(contour_engine *engine)
+{
+    pool_destroy(engine->pool);
     for (int i = 0; i < CONTOUR_CONFIG_COUNT; i++)
     {
-        char filename[FILENAME_MAX_SIZE];
-        sprintf(filename, "./contours/%d.ppm", i);
-        map[i] = read_ppm(filename);
+        free(engine->contour_map[i]->data);
+        free(engine->contour_map[i]);
     }
-
-    return map;
+    free(engine->contour_map);
+    free(engine);
 }
 
-// Updates a particular section of an image with the corresponding contour pixels.
-// Used to create the complete contour image.
-void update_image(ppm_image *image, ppm_image *contour, int x, int y)
+// Runs the plain pipeline on one image and returns the contour image. The input is freed if a
+// rescaled copy had to be made.
+ppm_image *process_image(contour_engine *engine, ppm_image *image)
 {
-    for (int i = 0; i < contour->x; i++)
-    {
-        for (int j = 0; j < contour->y; j++)
-        {
-            int contour_pixel_index = contour->x * i + j;
-            int image_pixel_index = (x + i) * image->y + y + j;
+    contour_job *job = contour_submit(engine, image, 0, NULL, NULL);
+    ppm_image *result = contour_wait(job);
 
-            image->data[image_pixel_index].red = contour->data[contour_pixel_index].red;
-            image->data[image_pixel_index].green = contour->data[contour_pixel_index].green;
-            image->data[image_pixel_index].blue = contour->data[contour_pixel_index].blue;
-        }
-    }
+    contour_job_free(job);
+    return result;
 }
 
-// Corresponds to step 1 of the marching squares algorithm, which focuses on sampling the image.
-// Builds a p x q grid of points with values which can be either 0 or 1, depending on how the
-// pixel values compare to the `sigma` reference value. The points are taken at equal distances
-// in the original image, based on the `step_x` and `step_y` arguments.
-unsigned char **sample_grid(ppm_image *image, unsigned char **grid, int thread_id, int N)
+typedef struct stream_end
 {
-    int p = image->x / STEP;
-    int q = image->y / STEP;
+    FILE *fp;
+    const char *name;
+    frame_queue *queue;
+} stream_end;
 
-    int start = thread_id * (p / N);
-    int end = (thread_id + 1) * (p / N);
+static void *stream_reader(void *arg)
+{
+    stream_end *in = (stream_end *)arg;
+    ppm_image *frame;
 
-    for (int i = start; i < end; i++)
+    do
     {
-        for (int j = 0; j < q; j++)
-        {
-            ppm_pixel curr_pixel = image->data[i * STEP * image->y + j * STEP];
+        frame = read_ppm_stream(in->fp, in->name);
+        queue_push(in->queue, frame);
+    } while (frame);
 
-            unsigned char curr_color = (curr_pixel.red + curr_pixel.green + curr_pixel.blue) / 3;
+    return NULL;
+}
 
-            if (curr_color > SIGMA)
-            {
-                grid[i][j] = 0;
-            }
-            else
-            {
-                grid[i][j] = 1;
-            }
-        }
+static void *stream_writer(void *arg)
+{
+    stream_end *out = (stream_end *)arg;
+    ppm_image *frame;
+
+    while ((frame = queue_pop(out->queue)))
+    {
+        write_ppm_stream(frame, out->fp);
+        fflush(out->fp);
+        free(frame->data);
+        free(frame);
     }
-    grid[p][q] = 0;
 
-    // last sample points have no neighbors below / to the right, so we use pixels on the
-    // last row / column of the input image for them
+    return NULL;
+}
 
-    int start1 = thread_id * (p / N);
-    int end1 = (thread_id + 1) * (p / N);
+// Streaming mode: contours every image of a stream of concatenated PPM images read from
+// stdin. Frame k + 1 is read and frame k - 1 written while the workers process frame k; the
+// queues between the stages hold at most STREAM_QUEUE_SIZE frames each.
+int run_stream(const char *out_file, int N, int march_threads)
+{
+    frame_queue in_queue, out_queue;
+    pthread_t reader, writer;
 
-    for (int i = start1; i < end1; i++)
+    FILE *out = strcmp(out_file, "-") ? fopen(out_file, "wb") : stdout;
+    if (!out)
     {
-        ppm_pixel curr_pixel = image->data[i * STEP * image->y + image->x - 1];
+        fprintf(stderr, "Unable to open file '%s'\n", out_file);
+        return 1;
+    }
 
-        unsigned char curr_color = (curr_pixel.red + curr_pixel.green + curr_pixel.blue) / 3;
+    contour_engine *engine = contour_engine_create(N, march_threads);
 
-        if (curr_color > SIGMA)
-        {
-            grid[i][q] = 0;
-        }
-        else
-        {
-            grid[i][q] = 1;
-        }
-    }
+    queue_init(&in_queue);
+    queue_init(&out_queue);
 
-    int start2 = thread_id * (q / N);
-    int end2 = (thread_id + 1) * (q / N);
+    stream_end in_end = {stdin, "<stdin>", &in_queue};
+    stream_end out_end = {out, out_file, &out_queue};
+    pthread_create(&reader, NULL, stream_reader, &in_end);
+    pthread_create(&writer, NULL, stream_writer, &out_end);
 
-    for (int j = start2; j < end2; j++)
+    ppm_image *frame;
+    while ((frame = queue_pop(&in_queue)))
     {
-        ppm_pixel curr_pixel = image->data[(image->x - 1) * image->y + j * STEP];
+        queue_push(&out_queue, process_image(engine, frame));
+    }
+    queue_push(&out_queue, NULL);
 
-        unsigned char curr_color = (curr_pixel.red + curr_pixel.green + curr_pixel.blue) / 3;
+    pthread_join(reader, NULL);
+    pthread_join(writer, NULL);
+    contour_engine_destroy(engine);
+    queue_destroy(&in_queue);
+    queue_destroy(&out_queue);
 
-        if (curr_color > SIGMA)
-        {
-            grid[p][j] = 0;
-        }
-        else
-        {
-            grid[p][j] = 1;
-        }
+    if (out != stdout)
+    {
+        fclose(out);
     }
 
-    return grid;
+    return 0;
 }
 
-// Corresponds to step 2 of the marching squares algorithm, which focuses on identifying the
-// type of contour which corresponds to each subgrid. It determines the binary value of each
-// sample fragment of the original image and replaces the pixels in the original image with
-// the pixels of the corresponding contour image accordingly.
-void march(ppm_image *image, unsigned char **grid, ppm_image **contour_map, int thread_id, int N)
+// Writes a contour image as `out_dir`/`name`, under a hidden name first and then renamed, so
+// whatever watches `out_dir` never sees a partial file. The hidden name is made unique with
+// mkstemp(), as farm nodes that were given the same job may write it at the same time. Frees
+// the image.
+void publish_image(ppm_image *result, const char *out_dir, const char *name)
 {
-    int p = image->x / STEP;
-    int q = image->y / STEP;
+    char out_path[PATH_MAX], tmp_path[PATH_MAX];
 
-    int start = thread_id * (p / N);
-    int end = (thread_id + 1) * (p / N);
+    if (snprintf(out_path, PATH_MAX, "%s/%s", out_dir, name) >= PATH_MAX ||
+        snprintf(tmp_path, PATH_MAX, "%s/.%s.XXXXXX", out_dir, name) >= PATH_MAX)
+    {
+        fprintf(stderr, "Path too long for '%s'\n", name);
+        exit(1);
+    }
 
-    for (int i = start; i < end; i++)
+    int fd = mkstemp(tmp_path);
+    FILE *fp = fd < 0 ? NULL : fdopen(fd, "wb");
+    if (!fp || fchmod(fd, 0644))
     {
-        for (int j = 0; j < q; j++)
-        {
-            unsigned char k = 8 * grid[i][j] + 4 * grid[i][j + 1] + 2 * grid[i + 1][j + 1] + 1 * grid[i + 1][j];
-            update_image(image, contour_map[k], i * STEP, j * STEP);
-        }
+        fprintf(stderr, "Unable to open file '%s'\n", tmp_path);
+        exit(1);
+    }
+
+    write_ppm_stream(result, fp);
+    if (fclose(fp) || rename(tmp_path, out_path))
+    {
+        fprintf(stderr, "Unable to write '%s'\n", out_path);
+        exit(1);
     }
+    free(result->data);
+    free(result);
 }
 
-// Calls `free` method on the utilized resources.
-void free_resources(ppm_image *image, ppm_image **contour_map, unsigned char **grid, int step_x)
+// Checks that `out_dir` is a directory other than `in_dir`.
+int check_output_dir(const char *in_dir, const char *out_dir)
 {
-    for (int i = 0; i < CONTOUR_CONFIG_COUNT; i++)
+    struct stat in_st, out_st;
+
+    if (stat(out_dir, &out_st) || !S_ISDIR(out_st.st_mode))
     {
-        free(contour_map[i]->data);
-        free(contour_map[i]);
+        fprintf(stderr, "'%s' is not a directory\n", out_dir);
+        return -1;
     }
-    free(contour_map);
-
-    for (int i = 0; i <= image->x / step_x; i++)
+    if (!stat(in_dir, &in_st) && in_st.st_dev == out_st.st_dev && in_st.st_ino == out_st.st_ino)
     {
-        free(grid[i]);
+        fprintf(stderr, "The output directory cannot be the input directory\n");
+        return -1;
     }
-    free(grid);
 
-    free(image->data);
-    free(image);
+    return 0;
 }
 
-ppm_image *rescale_image(struct image *imagine)
+// Watch mode: contours every .ppm file completed in `in_dir` into a file of the same name in
+// `out_dir`, until `in_dir` is removed.
+int run_watch(const char *in_dir, const char *out_dir, int N, int march_threads)
 {
-    uint8_t sample[3];
+    char in_path[PATH_MAX];
+    const char *name;
 
-    ppm_image *image = imagine->image;
-    ppm_image *new_image = imagine->scaled_image;
+    if (check_output_dir(in_dir, out_dir))
+    {
+        return 1;
+    }
 
-    // use bicubic interpolation for scaling
-    int start = imagine->thread_id * (new_image->x / imagine->N);
-    int end = (imagine->thread_id + 1) * (new_image->x / imagine->N);
+    contour_engine *engine = contour_engine_create(N, march_threads);
+    dir_watch *dw = watch_open(in_dir);
 
-    for (int i = start; i < end && i < new_image->x; i++)
+    while ((name = watch_next(dw)))
     {
-        for (int j = 0; j < new_image->y; j++)
+        if (snprintf(in_path, PATH_MAX, "%s/%s", in_dir, name) >= PATH_MAX)
         {
-            float u = (float)i / (float)(new_image->x - 1);
-            float v = (float)j / (float)(new_image->y - 1);
-            sample_bicubic(image, u, v, sample);
+            fprintf(stderr, "Path too long for '%s'\n", name);
+            continue;
+        }
 
-            new_image->data[i * new_image->y + j].red = sample[0];
-            new_image->data[i * new_image->y + j].green = sample[1];
-            new_image->data[i * new_image->y + j].blue = sample[2];
+        // a bad file is set aside instead of stopping the watcher
+        ppm_image *image = try_read_ppm(in_path);
+        if (!image)
+        {
+            fprintf(stderr, "Moving '%s' to %s\n", name, WATCH_FAILED_DIR);
+            watch_reject(dw, name);
+            continue;
         }
+
+        publish_image(process_image(engine, image), out_dir, name);
     }
 
-    return new_image;
+    watch_close(dw);
+    contour_engine_destroy(engine);
+
+    return 0;
 }
 
-ppm_image *allocate_rescale()
+// Farm mode: contours the jobs of a farm directory (see farm.h) into `out_dir`, next to any
+// number of other processes on this or other machines, until no job is left anywhere. A job is
+// read while the previous one is on the pool.
+int run_farm(const char *root, const char *out_dir, int N, int march_threads, int lease)
 {
+    char names[FARM_IN_FLIGHT][NAME_MAX + 1];
+    contour_job *jobs[FARM_IN_FLIGHT];
+    int first = 0, count = 0;
+    time_t last_check = 0;
 
-    // alloc memory for image
-    ppm_image *new_image = (ppm_image *)malloc(sizeof(ppm_image));
-    if (!new_image)
+    if (check_output_dir(root, out_dir))
     {
-        fprintf(stderr, "Unable to allocate memory\n");
-        exit(1);
+        return 1;
     }
-    new_image->x = RESCALE_X;
-    new_image->y = RESCALE_Y;
 
-    new_image->data = (ppm_pixel *)malloc(new_image->x * new_image->y * sizeof(ppm_pixel));
-    if (!new_image)
+    contour_engine *engine = contour_engine_create(N, march_threads);
+    farm *f = farm_open(root, lease);
+
+    for (;;)
     {
-        fprintf(stderr, "Unable to allocate memory\n");
-        exit(1);
+        char path[PATH_MAX];
+        int claimed = 0;
+
+        if (count < FARM_IN_FLIGHT)
+        {
+            if (time(NULL) - last_check >= (lease / 3 > 0 ? lease / 3 : 1))
+            {
+                farm_requeue_expired(f);
+                last_check = time(NULL);
+            }
+            claimed = farm_claim(f, names[(first + count) % FARM_IN_FLIGHT]);
+        }
+
+        if (claimed)
+        {
+            int k = (first + count) % FARM_IN_FLIGHT;
+            if (snprintf(path, PATH_MAX, "%s/%s", f->claimed, names[k]) >= PATH_MAX)
+            {
+                fprintf(stderr, "Path too long for '%s'\n", names[k]);
+                exit(1);
+            }
+
+            // a corrupt job is set aside, every node would fail on it the same way
+            ppm_image *image = try_read_ppm(path);
+            if (!image)
+            {
+                fprintf(stderr, "Moving '%s' to failed/\n", names[k]);
+                farm_fail(f, names[k]);
+                continue;
+            }
+
+            jobs[k] = contour_submit(engine, image, 0, NULL, NULL);
+            count++;
+            continue;
+        }
+
+        if (count)
+        {
+            publish_image(contour_wait(jobs[first]), out_dir, names[first]);
+            contour_job_free(jobs[first]);
+            if (farm_complete(f, names[first]))
+            {
+                fprintf(stderr, "Lost the lease of '%s'\n", names[first]);
+            }
+            first = (first + 1) % FARM_IN_FLIGHT;
+            count--;
+            continue;
+        }
+
+        // nothing left to claim: done once no other node holds a job that could come back, and
+        // none was just requeued for this node to claim
+        if (!farm_requeue_expired(f))
+        {
+            break;
+        }
+        last_check = time(NULL);
+        sleep(1);
     }
-    return new_image;
+
+    farm_close(f);
+    contour_engine_destroy(engine);
+
+    return 0;
 }
 
-void *apeleaza(void *arg)
+// libtema1.so leaves the command line tool out, see async.h.
+#ifndef TEMA1_LIBRARY
+int main(int argc, char *argv[])
 {
+    options opts;
 
-    struct image *im = (struct image *)arg;
-    if (im->image != im->scaled_image)
+    if (argc < 4 || parse_options(argc, argv, &opts))
     {
-        im->scaled_image = rescale_image(im);
+        fprintf(stderr, "Usage: ./tema1 <in_file | - | in_dir> <out_file | - | out_dir> <P> [--mosaic] [--pyramid <levels>]\n"
+                        "       [--tiled <tile>] [--vector <file>] [--digest] [--roofline]\n"
+                        "       [--pread] [--runs] [--window <size>]\n"
+                        "       [--adaptive] [--march-threads <n|cores>] [--slo <ms> [--cost-model <file>]]\n"
+                        "       [--overlay] [--polygons <file>] [--geometry <file>]\n"
+                        "       [--change <earlier_file> [--change-mask <file>]]\n"
+                        "       [--affine <a,b,c,d,e,f> | --deskew <degrees>]\n"
+                        "       <farm_dir> <out_dir> <P> --farm [--lease <seconds>]\n");
+        return 1;
     }
-    pthread_barrier_wait(im->barrier);
-    im->grid = sample_grid(im->scaled_image, im->grid, im->thread_id, im->N);
-    pthread_barrier_wait(im->barrier);
-    march(im->scaled_image, im->grid, im->contour_map, im->thread_id, im->N);
-    pthread_barrier_wait(im->barrier);
 
-    pthread_exit(NULL);
-}
+    int N = atoi(argv[3]);
+    int march_threads = march_thread_count(N, opts.march_threads);
 
-unsigned char **allocate_grid(ppm_image *image)
-{
+    struct stat in_st;
+    int watch = !stat(argv[1], &in_st) && S_ISDIR(in_st.st_mode);
 
-    int p = image->x / STEP;
-    int q = image->y / STEP;
-    unsigned char **grid = (unsigned char **)malloc((p + 1) * sizeof(unsigned char *));
-    if (!grid)
+    if (opts.farm && !watch)
     {
-        fprintf(stderr, "Unable to allocate memory\n");
-        exit(1);
+        fprintf(stderr, "--farm needs a farm directory\n");
+        return 1;
     }
 
-    for (int i = 0; i <= p; i++)
+    if (!strcmp(argv[1], "-") || watch)
     {
-        grid[i] = (unsigned char *)malloc((q + 1) * sizeof(unsigned char));
-        if (!grid[i])
+        if (opts.mosaic || opts.pyramid_levels || opts.tile || opts.vector || opts.digest || opts.roofline ||
+            opts.pread || opts.runs || opts.window ||
+            opts.adaptive || opts.slo || opts.overlay || opts.polygons ||
+            opts.geometry || opts.change || opts.affine || opts.deskew)
         {
-            fprintf(stderr, "Unable to allocate memory\n");
-            exit(1);
+            fprintf(stderr, "Reading from stdin or a directory does not support any option\n");
+            return 1;
+        }
+        if (opts.farm)
+        {
+            return run_farm(argv[1], argv[2], N, march_threads, opts.lease ? opts.lease : FARM_LEASE_SECONDS);
         }
+        return watch ? run_watch(argv[1], argv[2], N, march_threads) : run_stream(argv[2], N, march_threads);
     }
-    return grid;
-}
 
-int main(int argc, char *argv[])
-{
-    if (argc < 4)
+    ppm_image *image;
+    mosaic *tiles = NULL;
+    row_source *source = NULL;
+    pread_source *loader = NULL;
+    pbm_mask *mask = NULL;
+
+    if (!opts.mosaic && is_pbm(argv[1]))
     {
-        fprintf(stderr, "Usage: ./tema1 <in_file> <out_file> <P>\n");
-        return 1;
+        // masks are already binary, so block means and adaptive thresholds have nothing to work on
+        if (opts.pread || opts.pyramid_levels || opts.slo || opts.overlay || opts.change || opts.affine ||
+            opts.deskew || opts.window || opts.adaptive)
+        {
+            fprintf(stderr, "PBM input cannot be combined with --pread, --pyramid, --slo, --overlay, --change, "
+                            "--affine, --deskew, --window or --adaptive\n");
+            return 1;
+        }
+
+        // masks are sampled bit by bit, only the contour image is allocated as RGB
+        mask = read_pbm(argv[1]);
+        image = allocate_image(mask->x, mask->y);
+        fill_margins(image);
+    }
+    else if (opts.mosaic)
+    {
+        // the input file is a tile manifest; small mosaics are simply stitched in memory
+        tiles = read_mosaic(argv[1]);
+        if (tiles->x <= RESCALE_X && tiles->y <= RESCALE_Y)
+        {
+            image = mosaic_to_image(tiles);
+            free_mosaic(tiles);
+            tiles = NULL;
+        }
+        else
+        {
+            image = &tiles->band;
+        }
+    }
+    else if (opts.pread)
+    {
+        // the workers load the payload themselves before doing anything else
+        loader = open_pread_source(argv[1]);
+        image = loader->image;
+    }
+    else
+    {
+        // the pixels keep arriving in the background; only rescaling can start before they all
+        // did, since every other phase works on the whole image
+        source = open_row_source(argv[1]);
+        image = source->image;
     }
 
-    int N = atoi(argv[3]);
+    // with a latency target, the size of the rescaled image, the resampling and the thread
+    // counts are chosen from the size of the input before anything else is done
+    int rescale_x = RESCALE_X, rescale_y = RESCALE_Y;
+    slo_plan plan;
+    if (opts.slo)
+    {
+        cost_model model;
+        default_cost_model(&model);
+        if (opts.cost_model)
+        {
+            load_cost_model(&model, opts.cost_model);
+        }
+
+        plan_slo(&model, image->x, image->y, N, opts.slo, &plan);
+        rescale_x = plan.size ? plan.size : image->x;
+        rescale_y = plan.size ? plan.size : image->y;
+        N = plan.N;
+        march_threads = plan.march_threads;
+    }
+
+    // a transformed image is resampled even at its own size, and only once it is fully read,
+    // since the source rows a band of output columns needs are no longer known in advance
+    int transform = opts.affine || opts.deskew;
+    if (source && ((image->x <= rescale_x && image->y <= rescale_y) || transform))
+    {
+        close_row_source(source);
+        source = NULL;
+    }
 
     struct image *imagine = (struct image *)malloc(N * sizeof(struct image));
 
@@ -302,25 +1497,130 @@ int main(int argc, char *argv[])
 
     pthread_barrier_init(&barrier, NULL, N);
 
-    ppm_image *image = read_ppm(argv[1]);
-
     // 0. Initialize contour map
     ppm_image **contour_map = init_contour_map();
+    overlay_tile *overlay = opts.overlay ? init_overlay_map(contour_map) : NULL;
     ppm_image *scaled_image;
 
     // 1. Rescale the image
-    if (image->x <= RESCALE_X && image->y <= RESCALE_Y)
+    if (mask || (!tiles && image->x <= rescale_x && image->y <= rescale_y && !transform))
     {
         // no need to rescale
         scaled_image = image;
     }
+    else if (transform && !tiles && image->x <= rescale_x && image->y <= rescale_y)
+    {
+        // a transformed image that fits keeps its size; a mosaic band is not sized yet here
+        scaled_image = allocate_image(image->x, image->y);
+    }
     else
     {
-        scaled_image = allocate_rescale();
+        scaled_image = allocate_image(rescale_x, rescale_y);
+    }
+
+    float *affine = opts.affine ? opts.matrix : NULL;
+    if (opts.deskew)
+    {
+        deskew_matrix(opts.matrix, opts.deskew, image->x, image->y);
+        affine = opts.matrix;
     }
 
     unsigned char **grid = allocate_grid(scaled_image);
 
+    // every pyramid level is half the size of the previous one and has its own grid
+    ppm_image *levels[PYRAMID_MAX_LEVELS];
+    unsigned char **level_grids[PYRAMID_MAX_LEVELS];
+    int level_count = 0;
+
+    if (opts.pyramid_levels)
+    {
+        level_count = pyramid_level_count(scaled_image, opts.pyramid_levels);
+        levels[0] = scaled_image;
+        level_grids[0] = grid;
+        for (int k = 1; k < level_count; k++)
+        {
+            levels[k] = allocate_image(levels[k - 1]->x / 2, levels[k - 1]->y / 2);
+            level_grids[k] = allocate_grid(levels[k]);
+        }
+    }
+
+    tiled_file *tiled = NULL;
+    if (opts.tile)
+    {
+        tiled = tiled_create(argv[2], scaled_image->x, scaled_image->y, opts.tile);
+    }
+
+    contour_index *index = NULL;
+    if (opts.vector)
+    {
+        index = create_contour_index(scaled_image->x / STEP, scaled_image->y / STEP);
+    }
+
+    polygon_set *polygons = NULL;
+    geometry_writer *geometry = NULL;
+    if (opts.polygons || opts.geometry)
+    {
+        polygons = create_polygon_set(scaled_image->x / STEP, scaled_image->y / STEP, N);
+    }
+    if (opts.geometry)
+    {
+        geometry = geometry_create(opts.geometry, N);
+    }
+
+    uint64_t *band_hashes = NULL;
+    if (opts.digest)
+    {
+        band_hashes = (uint64_t *)calloc(scaled_image->x / STEP + 1, sizeof(uint64_t));
+        if (!band_hashes)
+        {
+            fprintf(stderr, "Unable to allocate memory\n");
+            exit(1);
+        }
+    }
+
+    sat *table = NULL;
+    if (opts.window)
+    {
+        table = allocate_sat(scaled_image);
+    }
+
+    // the earlier image is streamed in like the input, and only sampled where the grid needs it
+    change_set *change = NULL;
+    if (opts.change)
+    {
+        row_source *before_source = open_row_source(opts.change);
+        ppm_image *before = before_source->image;
+        int before_x = before->x > rescale_x || before->y > rescale_y ? rescale_x : before->x;
+        int before_y = before->x > rescale_x || before->y > rescale_y ? rescale_y : before->y;
+
+        if (before_x != scaled_image->x || before_y != scaled_image->y)
+        {
+            fprintf(stderr, "'%s' and '%s' do not have the same size\n", opts.change, argv[1]);
+            return 1;
+        }
+
+        change = create_change_set(before_source, scaled_image->x, scaled_image->y, N);
+    }
+
+    tile_stats *adaptive = NULL;
+    if (opts.adaptive)
+    {
+        adaptive = create_tile_stats(scaled_image->x, scaled_image->y, N);
+    }
+
+    machine_limits limits;
+    phase_stats *stats = NULL;
+    if (opts.roofline || opts.slo)
+    {
+        // measured before the pipeline starts, so that it runs on an idle machine
+        if (opts.roofline)
+        {
+            measure_machine(&limits, N);
+        }
+        stats = create_phase_stats(N);
+        stats->active[PHASE_MARCH] = level_count ? N : march_threads;
+    }
+
     for (int i = 0; i < N; i++)
     {
         imagine[i].N = N;
@@ -330,6 +1630,29 @@ int main(int argc, char *argv[])
         imagine[i].grid = grid;
         imagine[i].contour_map = contour_map;
         imagine[i].barrier = &barrier;
+        imagine[i].mosaic = tiles;
+        imagine[i].levels = levels;
+        imagine[i].level_grids = level_grids;
+        imagine[i].level_count = level_count;
+        imagine[i].tiled = tiled;
+        imagine[i].index = index;
+        imagine[i].band_hashes = band_hashes;
+        imagine[i].stats = stats;
+        imagine[i].source = source;
+        imagine[i].loader = loader;
+        imagine[i].mask = mask;
+        imagine[i].runs = opts.runs;
+        imagine[i].sat = table;
+        imagine[i].window = opts.window;
+        imagine[i].adaptive = adaptive;
+        imagine[i].march_threads = march_threads;
+        imagine[i].bilinear = opts.slo && plan.bilinear;
+        imagine[i].overlay = overlay;
+        imagine[i].polygons = polygons;
+        imagine[i].rings = opts.polygons != NULL;
+        imagine[i].geometry = geometry;
+        imagine[i].change = change;
+        imagine[i].affine = affine;
 
         pthread_create(&threads[i], NULL, apeleaza, &imagine[i]);
     }
@@ -339,9 +1662,120 @@ int main(int argc, char *argv[])
         pthread_join(threads[i], NULL);
     }
 
+    if (source)
+    {
+        close_row_source(source);
+    }
+
+    if (loader)
+    {
+        close_pread_source(loader);
+    }
+
+    if (mask)
+    {
+        free_pbm(mask);
+    }
+
+    if (table)
+    {
+        free_sat(table);
+    }
+
+    if (adaptive)
+    {
+        free_tile_stats(adaptive);
+    }
+
+    if (change)
+    {
+        if (change->before_source)
+        {
+            close_row_source(change->before_source);
+        }
+        report_changes(stderr, change);
+        if (opts.change_mask)
+        {
+            write_change_mask(change, opts.change_mask);
+        }
+        free_change_set(change);
+    }
+
+    free(overlay);
+
+    if (stats)
+    {
+        phase_work work[PHASE_COUNT];
+        int source_x = tiles ? tiles->x : image->x;
+        int source_y = tiles ? tiles->y : image->y;
+
+        if (opts.slo)
+        {
+            report_slo(stderr, &plan, stats);
+        }
+        if (opts.roofline)
+        {
+            estimate_phase_work(source_x, source_y, scaled_image, scaled_image != image, work);
+            report_roofline(stderr, stats, work, &limits);
+        }
+        free_phase_stats(stats);
+    }
+
     // 4. Write output
-    write_ppm(scaled_image, argv[2]);
+    if (index)
+    {
+        // the spatial index is saved next to the segments, as <vector file>.idx
+        char *index_file = (char *)malloc(strlen(opts.vector) + 5);
+        sprintf(index_file, "%s.idx", opts.vector);
+        write_vector(index, opts.vector);
+        write_contour_index(index, index_file);
+        free(index_file);
+        free_contour_index(index);
+    }
+
+    if (geometry)
+    {
+        geometry_close(geometry, polygons);
+    }
+
+    if (polygons)
+    {
+        if (opts.polygons)
+        {
+            write_polygons(polygons, opts.polygons);
+        }
+        free_polygon_set(polygons);
+    }
+
+    if (level_count > 0)
+    {
+        for (int k = 0; k < level_count; k++)
+        {
+            write_tile_set(levels[k], argv[2], k);
+        }
+    }
+    else if (tiled)
+    {
+        tiled_close(tiled);
+    }
+    else if (band_hashes)
+    {
+        // only the digest is reported, `out_file` is left untouched
+        uint64_t digest = digest_combine(band_hashes, scaled_image->x / STEP + 1, scaled_image->x, scaled_image->y);
+        printf("%016llx  %s\n", (unsigned long long)digest, argv[1]);
+        free(band_hashes);
+    }
+    else
+    {
+        write_ppm(scaled_image, argv[2]);
+    }
     pthread_barrier_destroy(&barrier);
 
+    if (tiles)
+    {
+        free_mosaic(tiles);
+    }
+
     return 0;
 }
+#endif
@@ -0,0 +1,254 @@
+#include "tiled.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#define TILED_RUN_MAX 255
+
+static void *tiled_alloc(size_t size)
+{
+    void *ptr = malloc(size);
+    if (!ptr)
+    {
+        fprintf(stderr, "Unable to allocate memory\n");
+        exit(1);
+    }
+    return ptr;
+}
+
+static uint64_t tiled_data_start(tiled_file *tf)
+{
+    return TILED_HEADER_SIZE + (uint64_t)tf->tiles_x * tf->tiles_y * sizeof(tiled_entry);
+}
+
+// Creates the container; the header and the index are only written by tiled_close(), once all
+// tile offsets are known.
+tiled_file *tiled_create(const char *filename, int x, int y, int tile)
+{
+    tiled_file *tf = (tiled_file *)tiled_alloc(sizeof(tiled_file));
+
+    tf->fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (tf->fd < 0)
+    {
+        fprintf(stderr, "Unable to open file '%s'\n", filename);
+        exit(1);
+    }
+
+    tf->x = x;
+    tf->y = y;
+    tf->tile = tile;
+    tf->tiles_x = (x + tile - 1) / tile;
+    tf->tiles_y = (y + tile - 1) / tile;
+    tf->index = (tiled_entry *)calloc((size_t)tf->tiles_x * tf->tiles_y, sizeof(tiled_entry));
+    if (!tf->index)
+    {
+        fprintf(stderr, "Unable to allocate memory\n");
+        exit(1);
+    }
+    tf->end = tiled_data_start(tf);
+
+    return tf;
+}
+
+void tiled_tile_size(tiled_file *tf, int ti, int tj, int *rows, int *cols)
+{
+    *rows = tf->x - ti * tf->tile;
+    *cols = tf->y - tj * tf->tile;
+    if (*rows > tf->tile)
+    {
+        *rows = tf->tile;
+    }
+    if (*cols > tf->tile)
+    {
+        *cols = tf->tile;
+    }
+}
+
+// Encodes `count` pixels as (run length, pixel) pairs. Returns the encoded size, or 0 as soon
+// as the encoding gets larger than `limit`.
+static size_t rle_encode(ppm_pixel *src, size_t count, unsigned char *dst, size_t limit)
+{
+    size_t size = 0;
+
+    for (size_t k = 0; k < count;)
+    {
+        size_t run = 1;
+        while (k + run < count && run < TILED_RUN_MAX && !memcmp(&src[k + run], &src[k], 3))
+        {
+            run++;
+        }
+
+        if (size + 4 > limit)
+        {
+            return 0;
+        }
+
+        dst[size] = (unsigned char)run;
+        memcpy(&dst[size + 1], &src[k], 3);
+        size += 4;
+        k += run;
+    }
+
+    return size;
+}
+
+// Encodes and writes one tile. Space for it is reserved with an atomic add on the end of the
+// file, so several threads can write their tiles at the same time.
+void tiled_write_tile(tiled_file *tf, ppm_image *img, int ti, int tj)
+{
+    int rows, cols;
+    tiled_tile_size(tf, ti, tj, &rows, &cols);
+
+    size_t raw_size = (size_t)rows * cols * sizeof(ppm_pixel);
+    ppm_pixel *raw = (ppm_pixel *)tiled_alloc(raw_size);
+    unsigned char *packed = (unsigned char *)tiled_alloc(raw_size);
+
+    for (int i = 0; i < rows; i++)
+    {
+        size_t offset = (size_t)(ti * tf->tile + i) * img->y + tj * tf->tile;
+        memcpy(raw + (size_t)i * cols, img->data + offset, cols * sizeof(ppm_pixel));
+    }
+
+    tiled_entry *entry = &tf->index[ti * tf->tiles_y + tj];
+    size_t packed_size = rle_encode(raw, (size_t)rows * cols, packed, raw_size - 1);
+    void *payload;
+
+    if (packed_size)
+    {
+        entry->encoding = TILED_RLE;
+        entry->size = packed_size;
+        payload = packed;
+    }
+    else
+    {
+        entry->encoding = TILED_RAW;
+        entry->size = raw_size;
+        payload = raw;
+    }
+
+    entry->offset = __atomic_fetch_add(&tf->end, entry->size, __ATOMIC_RELAXED);
+    if (pwrite(tf->fd, payload, entry->size, entry->offset) != (ssize_t)entry->size)
+    {
+        fprintf(stderr, "Unable to write tile (%d, %d)\n", ti, tj);
+        exit(1);
+    }
+
+    free(raw);
+    free(packed);
+}
+
+// Writes the header and the index and closes the file.
+void tiled_close(tiled_file *tf)
+{
+    uint32_t header[6];
+    size_t index_size = (size_t)tf->tiles_x * tf->tiles_y * sizeof(tiled_entry);
+
+    memcpy(&header[0], TILED_MAGIC, 4);
+    header[1] = tf->x;
+    header[2] = tf->y;
+    header[3] = tf->tile;
+    header[4] = tf->tiles_x;
+    header[5] = tf->tiles_y;
+
+    if (pwrite(tf->fd, header, TILED_HEADER_SIZE, 0) != TILED_HEADER_SIZE ||
+        pwrite(tf->fd, tf->index, index_size, TILED_HEADER_SIZE) != (ssize_t)index_size)
+    {
+        fprintf(stderr, "Unable to write the tile index\n");
+        exit(1);
+    }
+
+    close(tf->fd);
+    free(tf->index);
+    free(tf);
+}
+
+// Opens a container for reading; only the header and the index are loaded.
+tiled_file *tiled_open(const char *filename)
+{
+    uint32_t header[6];
+    tiled_file *tf = (tiled_file *)tiled_alloc(sizeof(tiled_file));
+
+    tf->fd = open(filename, O_RDONLY);
+    if (tf->fd < 0)
+    {
+        fprintf(stderr, "Unable to open file '%s'\n", filename);
+        exit(1);
+    }
+
+    if (pread(tf->fd, header, TILED_HEADER_SIZE, 0) != TILED_HEADER_SIZE ||
+        memcmp(&header[0], TILED_MAGIC, 4))
+    {
+        fprintf(stderr, "Invalid tiled container '%s'\n", filename);
+        exit(1);
+    }
+
+    tf->x = header[1];
+    tf->y = header[2];
+    tf->tile = header[3];
+    tf->tiles_x = header[4];
+    tf->tiles_y = header[5];
+
+    size_t index_size = (size_t)tf->tiles_x * tf->tiles_y * sizeof(tiled_entry);
+    tf->index = (tiled_entry *)tiled_alloc(index_size);
+    if (pread(tf->fd, tf->index, index_size, TILED_HEADER_SIZE) != (ssize_t)index_size)
+    {
+        fprintf(stderr, "Invalid tiled container '%s'\n", filename);
+        exit(1);
+    }
+    tf->end = 0;
+
+    return tf;
+}
+
+// Fetches one tile with a single pread() and decodes it into `out`, which must hold
+// tile * tile pixels. Returns 0 on success and -1 if the tile is missing or corrupt.
+int tiled_read_tile(tiled_file *tf, int ti, int tj, ppm_pixel *out)
+{
+    int rows, cols;
+
+    if (ti < 0 || tj < 0 || ti >= tf->tiles_x || tj >= tf->tiles_y)
+    {
+        return -1;
+    }
+
+    tiled_tile_size(tf, ti, tj, &rows, &cols);
+    tiled_entry *entry = &tf->index[ti * tf->tiles_y + tj];
+    size_t count = (size_t)rows * cols;
+
+    if (entry->encoding == TILED_RAW)
+    {
+        if (entry->size != count * sizeof(ppm_pixel))
+        {
+            return -1;
+        }
+        return pread(tf->fd, out, entry->size, entry->offset) == (ssize_t)entry->size ? 0 : -1;
+    }
+
+    unsigned char *packed = (unsigned char *)tiled_alloc(entry->size);
+    if (pread(tf->fd, packed, entry->size, entry->offset) != (ssize_t)entry->size)
+    {
+        free(packed);
+        return -1;
+    }
+
+    size_t k = 0;
+    for (size_t pos = 0; pos + 4 <= entry->size; pos += 4)
+    {
+        for (int run = 0; run < packed[pos] && k < count; run++)
+        {
+            memcpy(&out[k++], &packed[pos + 1], 3);
+        }
+    }
+    free(packed);
+
+    return k == count ? 0 : -1;
+}
+
+void tiled_free(tiled_file *tf)
+{
+    close(tf->fd);
+    free(tf->index);
+    free(tf);
+}
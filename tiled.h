@@ -0,0 +1,43 @@
+#ifndef TILED_H
+#define TILED_H
+
+#include "helpers.h"
+
+// Tiled output container. The file starts with a fixed header and an index with one entry per
+// tile, followed by the tile payloads in no particular order:
+//     "TPPM" x y tile tiles_x tiles_y            (uint32, host byte order)
+//     tiles_x * tiles_y * tiled_entry            (tile (ti, tj) at ti * tiles_y + tj)
+// A tile covers `tile` x `tile` pixels (less on the border) in the same row-major layout as the
+// image data, and is stored either raw or run-length encoded, whichever is smaller.
+#define TILED_MAGIC         "TPPM"
+#define TILED_HEADER_SIZE   24
+#define TILED_RAW           0
+#define TILED_RLE           1
+
+typedef struct tiled_entry
+{
+    uint64_t offset;
+    uint32_t size;
+    uint32_t encoding;
+} tiled_entry;
+
+typedef struct tiled_file
+{
+    int fd;
+    int x, y;
+    int tile;
+    int tiles_x, tiles_y;
+    tiled_entry *index;
+    uint64_t end;
+} tiled_file;
+
+tiled_file *tiled_create(const char *filename, int x, int y, int tile);
+void tiled_write_tile(tiled_file *tf, ppm_image *img, int ti, int tj);
+void tiled_close(tiled_file *tf);
+
+tiled_file *tiled_open(const char *filename);
+void tiled_tile_size(tiled_file *tf, int ti, int tj, int *rows, int *cols);
+int tiled_read_tile(tiled_file *tf, int ti, int tj, ppm_pixel *out);
+void tiled_free(tiled_file *tf);
+
+#endif
@@ -0,0 +1,331 @@
+#include "vector.h"
+#include "contour.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define CLAMP(v, min, max) if(v < min) { v = min; } else if(v > max) { v = max; }
+
+// Pairs of cell edges joined by a segment for each of the 16 configurations, indexed the same
+// way as the contour map (8 * top left + 4 * top right + 2 * bottom right + 1 * bottom left).
+const signed char case_edges[CONTOUR_CONFIG_COUNT][4] = {
+    {-1, -1, -1, -1},
+    {EDGE_LEFT, EDGE_BOTTOM, -1, -1},
+    {EDGE_BOTTOM, EDGE_RIGHT, -1, -1},
+    {EDGE_LEFT, EDGE_RIGHT, -1, -1},
+    {EDGE_TOP, EDGE_RIGHT, -1, -1},
+    {EDGE_LEFT, EDGE_TOP, EDGE_BOTTOM, EDGE_RIGHT},
+    {EDGE_TOP, EDGE_BOTTOM, -1, -1},
+    {EDGE_LEFT, EDGE_TOP, -1, -1},
+    {EDGE_LEFT, EDGE_TOP, -1, -1},
+    {EDGE_TOP, EDGE_BOTTOM, -1, -1},
+    {EDGE_TOP, EDGE_RIGHT, EDGE_LEFT, EDGE_BOTTOM},
+    {EDGE_TOP, EDGE_RIGHT, -1, -1},
+    {EDGE_LEFT, EDGE_RIGHT, -1, -1},
+    {EDGE_BOTTOM, EDGE_RIGHT, -1, -1},
+    {EDGE_LEFT, EDGE_BOTTOM, -1, -1},
+    {-1, -1, -1, -1},
+};
+
+// Edge midpoints, in half cells from the top left corner: {row, column}.
+static const int edge_midpoint[4][2] = {{0, 1}, {1, 2}, {2, 1}, {1, 0}};
+
+static void *index_alloc(size_t size)
+{
+    void *ptr = calloc(1, size ? size : 1);
+    if (!ptr)
+    {
+        fprintf(stderr, "Unable to allocate memory\n");
+        exit(1);
+    }
+    return ptr;
+}
+
+// Computes the segments of cell (i, j) from the same configuration march() uses.
+// Returns how many were written to `seg` (0, 1 or 2 for the saddle cases).
+int cell_segments(unsigned char **grid, int i, int j, segment seg[2])
+{
+    unsigned char k = cell_config(grid, i, j);
+    int count = 0;
+
+    for (int e = 0; e < 4 && case_edges[k][e] >= 0; e += 2)
+    {
+        const int *a = edge_midpoint[(int)case_edges[k][e]];
+        const int *b = edge_midpoint[(int)case_edges[k][e + 1]];
+
+        seg[count].y0 = i * STEP + a[0] * STEP / 2;
+        seg[count].x0 = j * STEP + a[1] * STEP / 2;
+        seg[count].y1 = i * STEP + b[0] * STEP / 2;
+        seg[count].x1 = j * STEP + b[1] * STEP / 2;
+        count++;
+    }
+
+    return count;
+}
+
+contour_index *create_contour_index(int p, int q)
+{
+    contour_index *idx = (contour_index *)index_alloc(sizeof(contour_index));
+
+    idx->p = p;
+    idx->q = q;
+    idx->buckets_x = (p + INDEX_BUCKET - 1) / INDEX_BUCKET;
+    idx->buckets_y = (q + INDEX_BUCKET - 1) / INDEX_BUCKET;
+    idx->bucket_start = (uint32_t *)index_alloc(
+        ((size_t)idx->buckets_x * idx->buckets_y + 1) * sizeof(uint32_t));
+
+    return idx;
+}
+
+// Visits the cells of bucket (bi, bj) in a fixed order; `out` may be NULL to only count.
+static uint32_t bucket_segments(contour_index *idx, unsigned char **grid, int bi, int bj, segment *out)
+{
+    segment seg[2];
+    uint32_t count = 0;
+
+    int i_end = (bi + 1) * INDEX_BUCKET < idx->p ? (bi + 1) * INDEX_BUCKET : idx->p;
+    int j_end = (bj + 1) * INDEX_BUCKET < idx->q ? (bj + 1) * INDEX_BUCKET : idx->q;
+
+    for (int i = bi * INDEX_BUCKET; i < i_end; i++)
+    {
+        for (int j = bj * INDEX_BUCKET; j < j_end; j++)
+        {
+            int n = cell_segments(grid, i, j, seg);
+            if (out)
+            {
+                memcpy(out + count, seg, n * sizeof(segment));
+            }
+            count += n;
+        }
+    }
+
+    return count;
+}
+
+// First pass: every thread counts the segments of its rows of buckets.
+void count_segments(contour_index *idx, unsigned char **grid, int thread_id, int N)
+{
+    int start = thread_id * idx->buckets_x / N;
+    int end = (thread_id + 1) * idx->buckets_x / N;
+
+    for (int bi = start; bi < end; bi++)
+    {
+        for (int bj = 0; bj < idx->buckets_y; bj++)
+        {
+            idx->bucket_start[bi * idx->buckets_y + bj + 1] = bucket_segments(idx, grid, bi, bj, NULL);
+        }
+    }
+}
+
+// Turns the counts into offsets and allocates the segments. Done by a single thread between
+// the two passes.
+void place_segments(contour_index *idx)
+{
+    int buckets = idx->buckets_x * idx->buckets_y;
+
+    idx->bucket_start[0] = 0;
+    for (int b = 0; b < buckets; b++)
+    {
+        idx->bucket_start[b + 1] += idx->bucket_start[b];
+    }
+
+    idx->count = idx->bucket_start[buckets];
+    idx->segments = (segment *)index_alloc(idx->count * sizeof(segment));
+}
+
+// Second pass: every thread writes the segments of its buckets at their final place.
+void fill_segments(contour_index *idx, unsigned char **grid, int thread_id, int N)
+{
+    int start = thread_id * idx->buckets_x / N;
+    int end = (thread_id + 1) * idx->buckets_x / N;
+
+    for (int bi = start; bi < end; bi++)
+    {
+        for (int bj = 0; bj < idx->buckets_y; bj++)
+        {
+            int b = bi * idx->buckets_y + bj;
+            bucket_segments(idx, grid, bi, bj, idx->segments + idx->bucket_start[b]);
+        }
+    }
+}
+
+// Writes the segments as text, one "x0 y0 x1 y1" line per segment. The line number of a
+// segment is the id returned by the queries.
+void write_vector(contour_index *idx, const char *filename)
+{
+    FILE *fp = fopen(filename, "w");
+    if (!fp)
+    {
+        fprintf(stderr, "Unable to open file '%s'\n", filename);
+        exit(1);
+    }
+
+    for (uint32_t s = 0; s < idx->count; s++)
+    {
+        segment *seg = &idx->segments[s];
+        fprintf(fp, "%d %d %d %d\n", seg->x0, seg->y0, seg->x1, seg->y1);
+    }
+
+    fclose(fp);
+}
+
+// Index file layout (host byte order):
+//     "CIDX" p q STEP INDEX_BUCKET count      (uint32)
+//     bucket_start[buckets_x * buckets_y + 1] (uint32)
+//     segments[count]                         (4 x int32)
+void write_contour_index(contour_index *idx, const char *filename)
+{
+    uint32_t header[6];
+    size_t buckets = (size_t)idx->buckets_x * idx->buckets_y + 1;
+
+    FILE *fp = fopen(filename, "wb");
+    if (!fp)
+    {
+        fprintf(stderr, "Unable to open file '%s'\n", filename);
+        exit(1);
+    }
+
+    memcpy(&header[0], INDEX_MAGIC, 4);
+    header[1] = idx->p;
+    header[2] = idx->q;
+    header[3] = STEP;
+    header[4] = INDEX_BUCKET;
+    header[5] = idx->count;
+
+    if (fwrite(header, INDEX_HEADER_SIZE, 1, fp) != 1 ||
+        fwrite(idx->bucket_start, sizeof(uint32_t), buckets, fp) != buckets ||
+        fwrite(idx->segments, sizeof(segment), idx->count, fp) != idx->count)
+    {
+        fprintf(stderr, "Unable to write file '%s'\n", filename);
+        exit(1);
+    }
+
+    fclose(fp);
+}
+
+contour_index *read_contour_index(const char *filename)
+{
+    uint32_t header[6];
+
+    FILE *fp = fopen(filename, "rb");
+    if (!fp)
+    {
+        fprintf(stderr, "Unable to open file '%s'\n", filename);
+        exit(1);
+    }
+
+    if (fread(header, INDEX_HEADER_SIZE, 1, fp) != 1 || memcmp(&header[0], INDEX_MAGIC, 4) ||
+        header[3] != STEP || header[4] != INDEX_BUCKET)
+    {
+        fprintf(stderr, "Invalid contour index '%s'\n", filename);
+        exit(1);
+    }
+
+    contour_index *idx = create_contour_index(header[1], header[2]);
+    size_t buckets = (size_t)idx->buckets_x * idx->buckets_y + 1;
+
+    idx->count = header[5];
+    idx->segments = (segment *)index_alloc(idx->count * sizeof(segment));
+
+    if (fread(idx->bucket_start, sizeof(uint32_t), buckets, fp) != buckets ||
+        fread(idx->segments, sizeof(segment), idx->count, fp) != idx->count)
+    {
+        fprintf(stderr, "Invalid contour index '%s'\n", filename);
+        exit(1);
+    }
+
+    fclose(fp);
+    return idx;
+}
+
+// Squared distance from (x, y) to a segment.
+static double segment_distance2(segment *seg, double x, double y)
+{
+    double dx = seg->x1 - seg->x0;
+    double dy = seg->y1 - seg->y0;
+    double len2 = dx * dx + dy * dy;
+    double t = len2 > 0 ? ((x - seg->x0) * dx + (y - seg->y0) * dy) / len2 : 0;
+
+    CLAMP(t, 0.0, 1.0);
+
+    double ex = seg->x0 + t * dx - x;
+    double ey = seg->y0 + t * dy - y;
+    return ex * ex + ey * ey;
+}
+
+// Visits the buckets that overlap the pixel rectangle [x0, x1] x [y0, y1] and stores the ids of
+// the segments accepted by `keep` (at most `max` of them). Returns the number of matches, which
+// may be larger than `max`.
+static int query_buckets(contour_index *idx, int x0, int y0, int x1, int y1, uint32_t *out, int max,
+                         int (*keep)(segment *, const int *), const int *arg)
+{
+    int cell = STEP * INDEX_BUCKET;
+    int found = 0;
+
+    // a segment can touch the border of the next cell, hence the extra bucket on each side
+    int bi0 = (y0 - 1) / cell, bi1 = (y1 + 1) / cell;
+    int bj0 = (x0 - 1) / cell, bj1 = (x1 + 1) / cell;
+    CLAMP(bi0, 0, idx->buckets_x - 1);
+    CLAMP(bi1, 0, idx->buckets_x - 1);
+    CLAMP(bj0, 0, idx->buckets_y - 1);
+    CLAMP(bj1, 0, idx->buckets_y - 1);
+
+    for (int bi = bi0; bi <= bi1; bi++)
+    {
+        for (int bj = bj0; bj <= bj1; bj++)
+        {
+            int b = bi * idx->buckets_y + bj;
+            for (uint32_t s = idx->bucket_start[b]; s < idx->bucket_start[b + 1]; s++)
+            {
+                if (keep(&idx->segments[s], arg))
+                {
+                    if (found < max)
+                    {
+                        out[found] = s;
+                    }
+                    found++;
+                }
+            }
+        }
+    }
+
+    return found;
+}
+
+static int keep_in_bbox(segment *seg, const int *box)
+{
+    int sx0 = seg->x0 < seg->x1 ? seg->x0 : seg->x1;
+    int sx1 = seg->x0 < seg->x1 ? seg->x1 : seg->x0;
+    int sy0 = seg->y0 < seg->y1 ? seg->y0 : seg->y1;
+    int sy1 = seg->y0 < seg->y1 ? seg->y1 : seg->y0;
+
+    return sx1 >= box[0] && sx0 <= box[2] && sy1 >= box[1] && sy0 <= box[3];
+}
+
+static int keep_near_point(segment *seg, const int *point)
+{
+    double radius = point[2];
+    return segment_distance2(seg, point[0], point[1]) <= radius * radius;
+}
+
+// Ids of the segments whose bounding box intersects [x0, x1] x [y0, y1].
+int query_bbox(contour_index *idx, int x0, int y0, int x1, int y1, uint32_t *out, int max)
+{
+    int box[4] = {x0, y0, x1, y1};
+    return query_buckets(idx, x0, y0, x1, y1, out, max, keep_in_bbox, box);
+}
+
+// Ids of the segments that pass within `radius` pixels of (x, y).
+int query_point(contour_index *idx, int x, int y, int radius, uint32_t *out, int max)
+{
+    int point[3] = {x, y, radius};
+    return query_buckets(idx, x - radius, y - radius, x + radius, y + radius, out, max,
+                         keep_near_point, point);
+}
+
+void free_contour_index(contour_index *idx)
+{
+    free(idx->bucket_start);
+    free(idx->segments);
+    free(idx);
+}
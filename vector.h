@@ -0,0 +1,51 @@
+#ifndef VECTOR_H
+#define VECTOR_H
+
+#include "helpers.h"
+
+// Cells per side of a bucket of the spatial index.
+#define INDEX_BUCKET        16
+#define INDEX_MAGIC         "CIDX"
+#define INDEX_HEADER_SIZE   24
+
+#define EDGE_TOP    0
+#define EDGE_RIGHT  1
+#define EDGE_BOTTOM 2
+#define EDGE_LEFT   3
+
+// Cell edges joined by the segments of each configuration, in pairs, -1 after the last one.
+extern const signed char case_edges[CONTOUR_CONFIG_COUNT][4];
+
+// One contour segment, in pixels of the contour image: x is the column and y the row.
+typedef struct segment
+{
+    int32_t x0, y0, x1, y1;
+} segment;
+
+// Segments of the whole contour, grouped by the INDEX_BUCKET x INDEX_BUCKET block of cells they
+// come from. The segments of bucket b are segments[bucket_start[b] .. bucket_start[b + 1]), so
+// the segment list is its own packed cell-bucket grid index.
+typedef struct contour_index
+{
+    int p, q;
+    int buckets_x, buckets_y;
+    uint32_t *bucket_start;
+    segment *segments;
+    uint32_t count;
+} contour_index;
+
+int cell_segments(unsigned char **grid, int i, int j, segment seg[2]);
+
+contour_index *create_contour_index(int p, int q);
+void count_segments(contour_index *idx, unsigned char **grid, int thread_id, int N);
+void place_segments(contour_index *idx);
+void fill_segments(contour_index *idx, unsigned char **grid, int thread_id, int N);
+
+void write_vector(contour_index *idx, const char *filename);
+void write_contour_index(contour_index *idx, const char *filename);
+contour_index *read_contour_index(const char *filename);
+int query_bbox(contour_index *idx, int x0, int y0, int x1, int y1, uint32_t *out, int max);
+int query_point(contour_index *idx, int x, int y, int radius, uint32_t *out, int max);
+void free_contour_index(contour_index *idx);
+
+#endif
@@ -0,0 +1,210 @@
+#define _GNU_SOURCE
+#include "watch.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Hidden files are skipped, which is where writers (and the mirror directory) keep partial files.
+static int is_spooled(const char *name)
+{
+    size_t length = strlen(name);
+    return name[0] != '.' && length > 4 && !strcmp(name + length - 4, ".ppm");
+}
+
+// Looks through the open descriptors of every process we can see for one that writes `st`.
+static int has_writer_fd(struct stat *st)
+{
+    char path[64], line[64];
+    struct dirent *proc_entry, *fd_entry;
+    struct stat fd_st;
+    int writing = 0;
+
+    DIR *proc = opendir("/proc");
+    while (proc && !writing && (proc_entry = readdir(proc)))
+    {
+        if (proc_entry->d_name[0] < '1' || proc_entry->d_name[0] > '9' ||
+            snprintf(path, sizeof(path), "/proc/%.16s/fd", proc_entry->d_name) >= (int)sizeof(path))
+        {
+            continue;
+        }
+
+        DIR *fds = opendir(path);
+        while (fds && !writing && (fd_entry = readdir(fds)))
+        {
+            snprintf(path, sizeof(path), "/proc/%.16s/fd/%.16s", proc_entry->d_name, fd_entry->d_name);
+            if (stat(path, &fd_st) || fd_st.st_dev != st->st_dev || fd_st.st_ino != st->st_ino)
+            {
+                continue;
+            }
+
+            // the second line of fdinfo is "flags:\t<octal open flags>"
+            snprintf(path, sizeof(path), "/proc/%.16s/fdinfo/%.16s", proc_entry->d_name, fd_entry->d_name);
+            FILE *fp = fopen(path, "r");
+            unsigned int flags;
+            while (fp && fgets(line, sizeof(line), fp))
+            {
+                if (sscanf(line, "flags: %o", &flags) == 1)
+                {
+                    writing = (flags & O_ACCMODE) != O_RDONLY;
+                    break;
+                }
+            }
+            if (fp)
+            {
+                fclose(fp);
+            }
+        }
+        if (fds)
+        {
+            closedir(fds);
+        }
+    }
+    if (proc)
+    {
+        closedir(proc);
+    }
+
+    return writing;
+}
+
+// Files found by the first listing may still be in the middle of being written. A read lease
+// is only granted when nobody has the file open for writing; where leases are not allowed (a
+// file of another user, a filesystem without them) the descriptors in /proc are checked.
+static int is_being_written(dir_watch *dw, const char *name)
+{
+    struct stat st;
+    int writing = 0;
+
+    int fd = openat(dirfd(dw->dir), name, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+    if (fd < 0)
+    {
+        // already gone, nothing to take
+        return 1;
+    }
+
+    if (!fcntl(fd, F_SETLEASE, F_RDLCK))
+    {
+        fcntl(fd, F_SETLEASE, F_UNLCK);
+    }
+    else if (errno == EAGAIN)
+    {
+        writing = 1;
+    }
+    else if (!fstat(fd, &st))
+    {
+        writing = has_writer_fd(&st);
+    }
+
+    close(fd);
+    return writing;
+}
+
+// The watch is added before the directory is listed, so a file that lands in between is seen
+// at least once (and possibly twice). A file that is skipped by the listing because it is still
+// open for writing is reported by its IN_CLOSE_WRITE.
+dir_watch *watch_open(const char *path)
+{
+    dir_watch *dw = (dir_watch *)malloc(sizeof(dir_watch));
+    if (!dw)
+    {
+        fprintf(stderr, "Unable to allocate memory\n");
+        exit(1);
+    }
+
+    dw->fd = inotify_init1(IN_CLOEXEC);
+    if (dw->fd < 0 || inotify_add_watch(dw->fd, path, IN_CLOSE_WRITE | IN_MOVED_TO | IN_ONLYDIR) < 0)
+    {
+        fprintf(stderr, "Unable to watch directory '%s'\n", path);
+        exit(1);
+    }
+
+    dw->dir = strlen(path) < PATH_MAX ? opendir(path) : NULL;
+    if (!dw->dir)
+    {
+        fprintf(stderr, "Unable to open directory '%s'\n", path);
+        exit(1);
+    }
+
+    // only the path is kept: an open descriptor would stop the removal of the directory from
+    // ending the watch
+    strcpy(dw->path, path);
+    dw->offset = 0;
+    dw->length = 0;
+    return dw;
+}
+
+// Blocks until the next file is complete and returns its name, which stays valid until the next
+// call. Returns NULL once the directory is gone.
+const char *watch_next(dir_watch *dw)
+{
+    struct dirent *entry;
+
+    while (dw->dir && (entry = readdir(dw->dir)))
+    {
+        if (entry->d_type != DT_DIR && is_spooled(entry->d_name) && !is_being_written(dw, entry->d_name))
+        {
+            return entry->d_name;
+        }
+    }
+    if (dw->dir)
+    {
+        closedir(dw->dir);
+        dw->dir = NULL;
+    }
+
+    for (;;)
+    {
+        while (dw->offset < dw->length)
+        {
+            struct inotify_event *event = (struct inotify_event *)(dw->buffer + dw->offset);
+            dw->offset += sizeof(struct inotify_event) + event->len;
+
+            // the watch is removed along with the directory
+            if (event->mask & IN_IGNORED)
+            {
+                return NULL;
+            }
+            if (event->len && !(event->mask & IN_ISDIR) && is_spooled(event->name))
+            {
+                return event->name;
+            }
+        }
+
+        dw->offset = 0;
+        dw->length = read(dw->fd, dw->buffer, WATCH_BUFFER_SIZE);
+        if (dw->length <= 0)
+        {
+            fprintf(stderr, "Unable to read inotify events\n");
+            exit(1);
+        }
+    }
+}
+
+// Moves a file that could not be processed to WATCH_FAILED_DIR, so it is kept for inspection
+// without being taken again.
+void watch_reject(dir_watch *dw, const char *name)
+{
+    char path[PATH_MAX], dir[PATH_MAX], failed[PATH_MAX];
+
+    if (snprintf(path, PATH_MAX, "%s/%s", dw->path, name) >= PATH_MAX ||
+        snprintf(dir, PATH_MAX, "%s/%s", dw->path, WATCH_FAILED_DIR) >= PATH_MAX ||
+        snprintf(failed, PATH_MAX, "%s/%s", dir, name) >= PATH_MAX ||
+        (mkdir(dir, 0777) && errno != EEXIST) || rename(path, failed))
+    {
+        fprintf(stderr, "Unable to move '%s' to %s\n", name, WATCH_FAILED_DIR);
+    }
+}
+
+void watch_close(dir_watch *dw)
+{
+    if (dw->dir)
+    {
+        closedir(dw->dir);
+    }
+    close(dw->fd);
+    free(dw);
+}
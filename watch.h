@@ -0,0 +1,31 @@
+#ifndef WATCH_H
+#define WATCH_H
+
+#include <dirent.h>
+#include <limits.h>
+#include <sys/inotify.h>
+#include <sys/types.h>
+
+// Subdirectory of the watched directory where files that are not valid images are moved.
+#define WATCH_FAILED_DIR ".failed"
+
+// Events read from inotify at once.
+#define WATCH_BUFFER_SIZE (16 * (sizeof(struct inotify_event) + NAME_MAX + 1))
+
+// Completed .ppm files of a spool directory: first the ones already there and no longer open
+// for writing, then every file closed after writing or moved in, as inotify reports them.
+typedef struct dir_watch
+{
+    int fd;
+    char path[PATH_MAX];
+    DIR *dir;
+    char buffer[WATCH_BUFFER_SIZE] __attribute__((aligned(__alignof__(struct inotify_event))));
+    ssize_t offset, length;
+} dir_watch;
+
+dir_watch *watch_open(const char *path);
+const char *watch_next(dir_watch *dw);
+void watch_reject(dir_watch *dw, const char *name);
+void watch_close(dir_watch *dw);
+
+#endif